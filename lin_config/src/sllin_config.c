@@ -16,6 +16,9 @@
 #include <netlink/cache.h>
 #include <netlink/route/link.h>
 #include <netlink/socket.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <linux/rtnetlink.h>
 
 #include <linux/can.h>
 #include <linux/can/bcm.h>
@@ -32,6 +35,7 @@ struct bcm_msg {
 struct sllin_connection {
 	int bcm_sock; // FIXME is necessary??
 	int can_sock;
+	int tty;
 	char iface[IFNAMSIZ+1];
 };
 
@@ -41,6 +45,65 @@ void sllin_ms_to_timeval(int ms, struct timeval *tv)
 	tv->tv_usec = (ms % 1000) * 1000;
 }
 
+/*
+ * Set the baudrate of the sllin interface (IFLA_SLLIN_BITRATE), the
+ * interface has to be down
+ */
+int sllin_link_config(struct linc_lin_state *linc_lin_state,
+			struct sllin_connection *sllin_connection)
+{
+	struct ifinfomsg ifi;
+	struct nl_sock *s;
+	struct nl_msg *msg;
+	struct nlattr *linkinfo;
+	struct nlattr *data;
+	struct rtnl_link *link;
+	int ret = -1;
+
+	if (linc_lin_state->baudrate <= 0)
+		return 0;
+
+	s = nl_socket_alloc();
+	if (!s)
+		return -1;
+	if (nl_connect(s, NETLINK_ROUTE) < 0)
+		goto out_sock;
+
+	msg = nlmsg_alloc_simple(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK);
+	if (!msg)
+		goto out_sock;
+
+	if (rtnl_link_get_kernel(s, 0, sllin_connection->iface, &link) < 0)
+		goto out_msg;
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = rtnl_link_get_ifindex(link);
+	rtnl_link_put(link);
+	if (nlmsg_append(msg, &ifi, sizeof(ifi), NLMSG_ALIGNTO) < 0)
+		goto out_msg;
+
+	linkinfo = nla_nest_start(msg, IFLA_LINKINFO);
+	if (!linkinfo ||
+	    nla_put_string(msg, IFLA_INFO_KIND, "sllin") < 0)
+		goto out_msg;
+	data = nla_nest_start(msg, IFLA_INFO_DATA);
+	if (!data ||
+	    nla_put_u32(msg, IFLA_SLLIN_BITRATE, linc_lin_state->baudrate) < 0)
+		goto out_msg;
+	nla_nest_end(msg, data);
+	nla_nest_end(msg, linkinfo);
+
+	if (nl_send_auto(s, msg) >= 0 && nl_wait_for_ack(s) >= 0)
+		ret = 0;
+
+out_msg:
+	nlmsg_free(msg);
+out_sock:
+	nl_socket_free(s);
+	return ret;
+}
+
 int sllin_interface_up(struct linc_lin_state *linc_lin_state,
 			struct sllin_connection *sllin_connection)
 {
@@ -91,7 +154,11 @@ int sllin_interface_up(struct linc_lin_state *linc_lin_state,
 	return 0;
 }
 
-int sllin_cache_config(struct linc_lin_state *linc_lin_state,
+/*
+ * Configure the frame cache one entry at a time by EFF CAN frames
+ * (sllin versions without SLLIN_IOC_CACHE_LOAD)
+ */
+int sllin_cache_config_frames(struct linc_lin_state *linc_lin_state,
 			struct sllin_connection *sllin_connection)
 {
 	int i;
@@ -147,6 +214,39 @@ int sllin_cache_config(struct linc_lin_state *linc_lin_state,
 	return 0;
 }
 
+/*
+ * Load the whole frame cache by a single ioctl(); sllin applies
+ * it atomically
+ */
+int sllin_cache_config(struct linc_lin_state *linc_lin_state,
+			struct sllin_connection *sllin_connection)
+{
+	struct lin_cache cache;
+	int ret;
+	int i;
+
+	memset(&cache, 0, sizeof(cache));
+	for (i = 0; i <= LIN_ID_MAX; i++) {
+		cache.entry[i].dlc = linc_lin_state->frame_entry[i].data_len;
+		if (cache.entry[i].dlc > 8)
+			cache.entry[i].dlc = 8;
+		memcpy(cache.entry[i].data,
+			linc_lin_state->frame_entry[i].data, 8);
+		if (linc_lin_state->frame_entry[i].status == 1) /* Is active */
+			cache.entry[i].frame_fl |= LIN_CACHE_RESPONSE;
+	}
+
+	ret = ioctl(sllin_connection->tty, SLLIN_IOC_CACHE_LOAD, &cache);
+	if (ret < 0) {
+		perror("ioctl SLLIN_IOC_CACHE_LOAD");
+		return sllin_cache_config_frames(linc_lin_state,
+			sllin_connection);
+	}
+
+	printf("Frame cache configured\n");
+	return 0;
+}
+
 int sllin_bcm_config(struct linc_lin_state *linc_lin_state,
 			struct sllin_connection *sllin_connection)
 {
@@ -213,6 +313,50 @@ int sllin_bcm_config(struct linc_lin_state *linc_lin_state,
 	return 0;
 }
 
+/*
+ * Download the scheduler entries as schedule table
+ * LIN_SCHED_TABLE_NORMAL and let sllin execute it
+ */
+int sllin_sched_config(struct linc_lin_state *linc_lin_state,
+			struct sllin_connection *sllin_connection)
+{
+	struct lin_sched_table table;
+	int sched_table = LIN_SCHED_TABLE_NORMAL;
+	int ret;
+	int i;
+
+	if (linc_lin_state->scheduler_entries_cnt > LIN_SCHED_SLOTS_MAX) {
+		fprintf(stderr, "Too many scheduler entries (max %d)\n",
+			LIN_SCHED_SLOTS_MAX);
+		return -1;
+	}
+	if (linc_lin_state->scheduler_entries_cnt == 0)
+		return 0;
+
+	memset(&table, 0, sizeof(table));
+	table.table = sched_table;
+	table.slots_cnt = linc_lin_state->scheduler_entries_cnt;
+	for (i = 0; i < linc_lin_state->scheduler_entries_cnt; i++) {
+		table.slot[i].lin_id = linc_lin_state->scheduler_entry[i].lin_id;
+		table.slot[i].delay_us =
+			linc_lin_state->scheduler_entry[i].interval_ms * 1000;
+	}
+
+	ret = ioctl(sllin_connection->tty, SLLIN_IOC_SCHED_SET_TABLE, &table);
+	if (ret < 0) {
+		perror("ioctl SLLIN_IOC_SCHED_SET_TABLE");
+		return -1;
+	}
+
+	ret = ioctl(sllin_connection->tty, SLLIN_IOC_SCHED_SWITCH, &sched_table);
+	if (ret < 0) {
+		perror("ioctl SLLIN_IOC_SCHED_SWITCH");
+		return -1;
+	}
+
+	return 0;
+}
+
 int sllin_config(struct linc_lin_state *linc_lin_state)
 {
 	int tty;
@@ -260,15 +404,28 @@ int sllin_config(struct linc_lin_state *linc_lin_state)
 		return LIN_EXIT_OK;
 	}
 
-	ret = sllin_bcm_config(linc_lin_state, &sllin_connection);
+	sllin_connection.tty = tty;
+
+	/* sllin versions without rtnetlink support use the baudrate
+	   module parameter */
+	ret = sllin_link_config(linc_lin_state, &sllin_connection);
 	if (ret < 0)
-		return ret;
+		fprintf(stderr, "Baudrate of %s not set\n",
+			sllin_connection.iface);
 
 	ret = sllin_interface_up(linc_lin_state, &sllin_connection);
 	if (ret < 0)
 		return ret;
 
 	ret = sllin_cache_config(linc_lin_state, &sllin_connection);
+	if (ret < 0)
+		return ret;
+
+	/* Schedule is executed by sllin itself; BCM timers are used only
+	   with sllin versions not supporting schedule tables */
+	ret = sllin_sched_config(linc_lin_state, &sllin_connection);
+	if (ret < 0)
+		ret = sllin_bcm_config(linc_lin_state, &sllin_connection);
 
 	/* !!! Do not close "tty" to enable newly
 	   configured tty line discipline */
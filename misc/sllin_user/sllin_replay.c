@@ -0,0 +1,386 @@
+/*
+ * sllin_replay.c - Feed recorded LIN traffic to sllin.c built in userspace
+ *
+ * The script describes what happens on the bus and on the network side
+ * of the interface; the driver reacts as it would on a real UART. One
+ * command per line, times are in microseconds relative to the start
+ * of the pass:
+ *
+ *   # comment
+ *   @<time>                  continue at <time>
+ *   wait <time>              let <time> pass
+ *   rx <hh>[/b|/f|/p|/o] ... characters received from the bus in one
+ *                            chunk, optionally flagged as break, framing,
+ *                            parity or overrun error
+ *   tx <id>#<hh>...          CAN frame sent to the interface, <id> in hex
+ *   tx <id>#R[<dlc>]         RTR frame (header request in Master mode)
+ *   up / down                interface up / down
+ *
+ * Output lists what the driver did with virtual timestamps:
+ * characters written to the bus ("wire"), break, baudrate changes and
+ * CAN frames passed to the network stack ("can").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sllin_shim.h"
+#include "linux/lin_bus.h"
+
+#define CMD_LINE_MAX		1024
+
+enum cmd_type {
+	CMD_AT,
+	CMD_WAIT,
+	CMD_RX,
+	CMD_TX,
+	CMD_UP,
+	CMD_DOWN,
+};
+
+struct cmd {
+	enum cmd_type type;
+	s64 us;
+	int len;
+	unsigned char data[CMD_LINE_MAX / 3];
+	char flags[CMD_LINE_MAX / 3];
+	struct can_frame cf;
+};
+
+static struct cmd *cmds;
+static int cmds_cnt;
+
+static bool quiet;
+static unsigned long frames_cnt;
+static unsigned long wire_cnt;
+
+static void out_time(void)
+{
+	printf("%12.3f ", (double)shim_now / NSEC_PER_USEC);
+}
+
+static void hook_wire(const unsigned char *buf, int count)
+{
+	int i;
+
+	wire_cnt += count;
+	if (quiet)
+		return;
+
+	out_time();
+	printf("wire ");
+	for (i = 0; i < count; i++)
+		printf(" %02X", buf[i]);
+	printf("\n");
+}
+
+static void hook_brk(int on)
+{
+	if (quiet)
+		return;
+
+	out_time();
+	printf("break %s\n", on ? "on" : "off");
+}
+
+static void hook_baud(unsigned int baud)
+{
+	if (quiet)
+		return;
+
+	out_time();
+	printf("baud  %u\n", baud);
+}
+
+static void hook_rx(struct net_device *dev, const struct can_frame *cf)
+{
+	int i;
+
+	frames_cnt++;
+	if (quiet)
+		return;
+
+	out_time();
+	printf("can   %08X [%d]", cf->can_id, cf->can_dlc);
+	if (!(cf->can_id & CAN_RTR_FLAG))
+		for (i = 0; i < cf->can_dlc && i < CAN_MAX_DLEN; i++)
+			printf(" %02X", cf->data[i]);
+	printf("\n");
+}
+
+static int parse_frame(char *s, struct can_frame *cf)
+{
+	char *hash = strchr(s, '#');
+	char *p;
+	int len = 0;
+
+	if (!hash)
+		return -1;
+
+	memset(cf, 0, sizeof(*cf));
+	*hash = '\0';
+	cf->can_id = strtoul(s, &p, 16);
+	if (*p)
+		return -1;
+
+	p = hash + 1;
+	if (*p == 'R' || *p == 'r') {
+		cf->can_id |= CAN_RTR_FLAG;
+		if (p[1])
+			cf->can_dlc = strtoul(p + 1, NULL, 10);
+		return 0;
+	}
+
+	while (p[0] && p[1] && len < CAN_MAX_DLEN) {
+		char byte[3] = { p[0], p[1], 0 };
+
+		cf->data[len++] = strtoul(byte, NULL, 16);
+		p += 2;
+		if (*p == '.')
+			p++;
+	}
+	if (*p)
+		return -1;
+
+	cf->can_dlc = len;
+	return 0;
+}
+
+static int parse_rx(char *args, struct cmd *c)
+{
+	char *tok;
+	char *p;
+
+	c->len = 0;
+	for (tok = strtok(args, " \t"); tok; tok = strtok(NULL, " \t")) {
+		if (c->len >= (int)sizeof(c->data))
+			return -1;
+
+		c->data[c->len] = strtoul(tok, &p, 16);
+		c->flags[c->len] = TTY_NORMAL;
+		if (*p == '/') {
+			switch (p[1]) {
+			case 'b': c->flags[c->len] = TTY_BREAK; break;
+			case 'f': c->flags[c->len] = TTY_FRAME; break;
+			case 'p': c->flags[c->len] = TTY_PARITY; break;
+			case 'o': c->flags[c->len] = TTY_OVERRUN; break;
+			default: return -1;
+			}
+			p += 2;
+		}
+		if ((p == tok) || *p)
+			return -1;
+		c->len++;
+	}
+
+	return c->len ? 0 : -1;
+}
+
+static int load_script(const char *fname)
+{
+	char line[CMD_LINE_MAX];
+	FILE *f;
+	int lineno = 0;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		perror(fname);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *s = line;
+		char *args;
+		struct cmd *c;
+		int err = 0;
+
+		lineno++;
+		s[strcspn(s, "\r\n")] = '\0';
+		while (*s == ' ' || *s == '\t')
+			s++;
+		if (!*s || *s == '#')
+			continue;
+
+		cmds = realloc(cmds, (cmds_cnt + 1) * sizeof(*cmds));
+		if (!cmds) {
+			perror("realloc");
+			exit(1);
+		}
+		c = &cmds[cmds_cnt];
+		memset(c, 0, sizeof(*c));
+
+		args = s + strcspn(s, " \t");
+		if (*args)
+			*args++ = '\0';
+
+		if (*s == '@') {
+			c->type = CMD_AT;
+			c->us = strtoll(s + 1, NULL, 10);
+		} else if (!strcmp(s, "wait")) {
+			c->type = CMD_WAIT;
+			c->us = strtoll(args, NULL, 10);
+		} else if (!strcmp(s, "rx")) {
+			c->type = CMD_RX;
+			err = parse_rx(args, c);
+		} else if (!strcmp(s, "tx")) {
+			c->type = CMD_TX;
+			err = parse_frame(args, &c->cf);
+		} else if (!strcmp(s, "up")) {
+			c->type = CMD_UP;
+		} else if (!strcmp(s, "down")) {
+			c->type = CMD_DOWN;
+		} else {
+			err = -1;
+		}
+
+		if (err) {
+			fprintf(stderr, "%s:%d: syntax error\n", fname, lineno);
+			fclose(f);
+			return -1;
+		}
+		cmds_cnt++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void run_script(struct tty_struct *tty, struct net_device *dev)
+{
+	ktime_t start = shim_now;
+	int i;
+
+	for (i = 0; i < cmds_cnt; i++) {
+		struct cmd *c = &cmds[i];
+		int ret;
+
+		switch (c->type) {
+		case CMD_AT:
+			shim_run_until(start + c->us * NSEC_PER_USEC);
+			break;
+		case CMD_WAIT:
+			shim_run_until(shim_now + c->us * NSEC_PER_USEC);
+			break;
+		case CMD_RX:
+			shim_tty_rx(tty, c->data, c->flags, c->len);
+			break;
+		case CMD_TX:
+			ret = shim_netdev_xmit(dev, &c->cf);
+			if (ret && !quiet)
+				fprintf(stderr, "tx %08X: %s\n", c->cf.can_id,
+					strerror(-ret));
+			break;
+		case CMD_UP:
+			shim_netdev_open(dev);
+			break;
+		case CMD_DOWN:
+			shim_netdev_close(dev);
+			break;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <script>\n"
+		"  -s         Slave mode (default Master)\n"
+		"  -m         Monitor (listen only)\n"
+		"  -a         Detect the baudrate (Slave mode)\n"
+		"  -b <baud>  LIN baudrate (default %d)\n"
+		"  -t <us>    Header timeout\n"
+		"  -E         The bus does not echo transmitted characters\n"
+		"  -f <n>     UART transmit FIFO size (default 4096)\n"
+		"  -n <n>     Replay the script <n> times\n"
+		"  -q         Print only the summary\n",
+		prog, LIN_DEFAULT_BAUDRATE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec t0, t1;
+	struct tty_struct *tty;
+	struct net_device *dev;
+	bool slave = false, monitor = false, autobaud = false, echo = true;
+	unsigned baud = 0, timeout = 0;
+	int fifo_size = 4096;
+	long passes = 1;
+	long pass;
+	double wall;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "smab:t:Ef:n:q")) != -1) {
+		switch (opt) {
+		case 's': slave = true; break;
+		case 'm': monitor = true; break;
+		case 'a': autobaud = true; break;
+		case 'b': baud = strtoul(optarg, NULL, 0); break;
+		case 't': timeout = strtoul(optarg, NULL, 0); break;
+		case 'E': echo = false; break;
+		case 'f': fifo_size = strtol(optarg, NULL, 0); break;
+		case 'n': passes = strtol(optarg, NULL, 0); break;
+		case 'q': quiet = true; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (load_script(argv[optind]))
+		return 1;
+
+	shim_hooks.wire = hook_wire;
+	shim_hooks.brk = hook_brk;
+	shim_hooks.baud = hook_baud;
+	shim_hooks.rx = hook_rx;
+
+	if (shim_module_init())
+		return 1;
+
+	tty = shim_tty_open(echo, fifo_size);
+	if (!tty)
+		return 1;
+	dev = shim_netdev_get();
+
+	if ((slave && shim_changelink(dev, IFLA_SLLIN_MASTER, 0)) ||
+		(monitor && shim_changelink(dev, IFLA_SLLIN_MONITOR, 1)) ||
+		(autobaud && shim_changelink(dev, IFLA_SLLIN_AUTOBAUD, 1)) ||
+		(baud && shim_changelink(dev, IFLA_SLLIN_BITRATE, baud)) ||
+		(timeout && shim_changelink(dev, IFLA_SLLIN_TIMEOUT, timeout))) {
+		fprintf(stderr, "Invalid configuration\n");
+		return 1;
+	}
+
+	if (shim_netdev_open(dev)) {
+		fprintf(stderr, "Can not bring %s up\n", dev->name);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (pass = 0; pass < passes; pass++)
+		run_script(tty, dev);
+	/* Let the driver finish whatever it started */
+	shim_run_until(shim_now + NSEC_PER_SEC);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	shim_tty_close(tty);
+	shim_module_exit();
+
+	wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	if (quiet || passes > 1)
+		fprintf(stderr, "%ld passes, %lu frames, %lu chars sent, "
+			"%.3f s virtual, %.3f s real, %.0f frames/s\n",
+			passes, frames_cnt, wire_cnt,
+			(double)shim_now / NSEC_PER_SEC, wall,
+			wall > 0 ? frames_cnt / wall : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,752 @@
+/*
+ * sllin_shim.c - Userspace run-time of the kernel API used by sllin.c
+ *
+ * Single threaded event loop over virtual time. Events are expirations
+ * of hrtimers and echoes of the characters sent to the bus by the UART
+ * model. Works queued to kthread workers run after each event.
+ */
+
+#include <stdarg.h>
+#include "sllin_shim.h"
+
+/* Should be in include/linux/tty.h */
+#define N_SLLIN			25
+
+#define SHIM_ECHO_MAX		4096
+
+ktime_t shim_now;
+int shim_in_irq;
+struct shim_hooks shim_hooks;
+
+static struct hrtimer *shim_timers;	/* sorted by expiration */
+
+static struct kthread_work *shim_work_head;
+static struct kthread_work **shim_work_tail = &shim_work_head;
+static bool shim_in_work;
+
+static struct tty_ldisc_ops *shim_ldisc;
+static struct rtnl_link_ops *shim_link_ops;
+static struct net_device *shim_netdev;
+static int shim_ifindex;
+
+/* Character on the wire, echoed back at @at */
+struct shim_char {
+	ktime_t at;
+	unsigned char c;
+	char flag;
+	bool tx;	/* written by the driver, holds a place in FIFO */
+};
+
+struct shim_uart {
+	struct tty_struct tty;
+	bool echo;
+	int fifo_size;
+	int fifo_used;
+	bool brk;
+	ktime_t wire_free;	/* end of the last character on the wire */
+	struct shim_char ch[SHIM_ECHO_MAX];
+	unsigned ch_head;
+	unsigned ch_tail;
+	bool hangup;
+};
+
+static struct shim_uart shim_uart;
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return 0;
+	return ((size_t)ret < size) ? ret : (size ? size - 1 : 0);
+}
+
+void shim_bug(const char *what)
+{
+	fprintf(stderr, "BUG at %lld ns: %s\n", (long long)shim_now, what);
+	abort();
+}
+
+/*****************************************
+ *  hrtimers
+ *****************************************/
+
+static void shim_timer_unlink(struct hrtimer *timer)
+{
+	struct hrtimer **p;
+
+	for (p = &shim_timers; *p; p = &(*p)->next) {
+		if (*p == timer) {
+			*p = timer->next;
+			break;
+		}
+	}
+	timer->next = NULL;
+	timer->queued = false;
+}
+
+static void shim_timer_enqueue(struct hrtimer *timer)
+{
+	struct hrtimer **p;
+
+	for (p = &shim_timers; *p; p = &(*p)->next)
+		if ((*p)->expires > timer->expires)
+			break;
+	timer->next = *p;
+	*p = timer;
+	timer->queued = true;
+}
+
+void hrtimer_init(struct hrtimer *timer, int clock, enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+	if (timer->queued)
+		shim_timer_unlink(timer);
+	timer->expires = (mode == HRTIMER_MODE_REL) ? shim_now + tim : tim;
+	shim_timer_enqueue(timer);
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	if (!timer->queued)
+		return 0;
+	shim_timer_unlink(timer);
+	return 1;
+}
+
+static void shim_timer_expire(struct hrtimer *timer)
+{
+	enum hrtimer_restart res;
+
+	shim_timer_unlink(timer);
+	shim_in_irq = 1;
+	res = timer->function(timer);
+	shim_in_irq = 0;
+	if ((res == HRTIMER_RESTART) && !timer->queued)
+		shim_timer_enqueue(timer);
+}
+
+/*****************************************
+ *  Workers
+ *****************************************/
+
+static struct task_struct shim_task;
+
+int kthread_worker_fn(void *worker_ptr)
+{
+	return 0;
+}
+
+struct task_struct *kthread_create_on_node(int (*threadfn)(void *data),
+		void *data, int node, const char namefmt[], ...)
+{
+	return &shim_task;
+}
+
+bool kthread_queue_work(struct kthread_worker *worker,
+			struct kthread_work *work)
+{
+	if (work->queued)
+		return false;
+
+	work->queued = true;
+	work->next = NULL;
+	*shim_work_tail = work;
+	shim_work_tail = &work->next;
+	return true;
+}
+
+/* Works never run nested, like on a single worker thread */
+static void shim_run_works(void)
+{
+	struct kthread_work *work;
+
+	if (shim_in_work)
+		return;
+
+	shim_in_work = true;
+	while ((work = shim_work_head) != NULL) {
+		shim_work_head = work->next;
+		if (!shim_work_head)
+			shim_work_tail = &shim_work_head;
+		work->queued = false;
+		work->func(work);
+	}
+	shim_in_work = false;
+
+	if (shim_uart.hangup) {
+		shim_uart.hangup = false;
+		shim_ldisc->hangup(&shim_uart.tty);
+	}
+}
+
+void kthread_flush_work(struct kthread_work *work)
+{
+	if (work->queued)
+		shim_run_works();
+}
+
+/*****************************************
+ *  Event loop
+ *****************************************/
+
+static bool shim_next_event(ktime_t *at)
+{
+	struct shim_uart *u = &shim_uart;
+	bool found = false;
+
+	if (shim_timers) {
+		*at = shim_timers->expires;
+		found = true;
+	}
+	if ((u->ch_head != u->ch_tail) &&
+		(!found || (u->ch[u->ch_tail % SHIM_ECHO_MAX].at < *at))) {
+		*at = u->ch[u->ch_tail % SHIM_ECHO_MAX].at;
+		found = true;
+	}
+
+	return found;
+}
+
+static void shim_uart_echo(struct shim_uart *u)
+{
+	struct shim_char ch = u->ch[u->ch_tail++ % SHIM_ECHO_MAX];
+
+	if (ch.tx)
+		u->fifo_used--;
+
+	if (u->echo && u->tty.disc_data)
+		shim_ldisc->receive_buf2(&u->tty, &ch.c, &ch.flag, 1);
+
+	if (ch.tx && test_bit(TTY_DO_WRITE_WAKEUP, &u->tty.flags) &&
+		u->tty.disc_data)
+		shim_ldisc->write_wakeup(&u->tty);
+}
+
+/*
+ * shim_step() -- Process the earliest pending event
+ *
+ * Returns false when there is nothing to do.
+ */
+bool shim_step(void)
+{
+	struct shim_uart *u = &shim_uart;
+	ktime_t at;
+
+	if (!shim_next_event(&at))
+		return false;
+
+	if (at > shim_now)
+		shim_now = at;
+
+	if (shim_timers && (shim_timers->expires == at))
+		shim_timer_expire(shim_timers);
+	else
+		shim_uart_echo(u);
+
+	shim_run_works();
+	return true;
+}
+
+void shim_run_until(ktime_t t)
+{
+	ktime_t at;
+
+	while (shim_next_event(&at) && (at <= t))
+		shim_step();
+
+	if (t > shim_now)
+		shim_now = t;
+}
+
+void shim_sleep(s64 ns)
+{
+	shim_run_until(shim_now + ns);
+}
+
+/*****************************************
+ *  IDR
+ *****************************************/
+
+int idr_alloc(struct idr *idr, void *ptr, int start, int end, gfp_t gfp)
+{
+	int id;
+
+	for (id = start; id < idr->size; id++)
+		if (!idr->used[id])
+			break;
+
+	if ((end > 0) && (id >= end))
+		return -ENOSPC;
+
+	if (id >= idr->size) {
+		int size = idr->size ? 2 * idr->size : 8;
+		void **p = realloc(idr->ptr, size * sizeof(*p));
+		bool *u = realloc(idr->used, size * sizeof(*u));
+
+		if (p)
+			idr->ptr = p;
+		if (u)
+			idr->used = u;
+		if (!p || !u)
+			return -ENOMEM;
+		memset(u + idr->size, 0, (size - idr->size) * sizeof(*u));
+		idr->size = size;
+	}
+
+	idr->used[id] = true;
+	idr->ptr[id] = ptr;
+	return id;
+}
+
+void *idr_find(struct idr *idr, int id)
+{
+	if ((id < 0) || (id >= idr->size) || !idr->used[id])
+		return NULL;
+	return idr->ptr[id];
+}
+
+void *idr_replace(struct idr *idr, void *ptr, int id)
+{
+	void *old;
+
+	if ((id < 0) || (id >= idr->size) || !idr->used[id])
+		return ERR_PTR(-ENOENT);
+	old = idr->ptr[id];
+	idr->ptr[id] = ptr;
+	return old;
+}
+
+void *idr_remove(struct idr *idr, int id)
+{
+	void *old = idr_find(idr, id);
+
+	if ((id >= 0) && (id < idr->size))
+		idr->used[id] = false;
+	return old;
+}
+
+void *idr_get_next(struct idr *idr, int *nextid)
+{
+	int id;
+
+	for (id = *nextid; id < idr->size; id++) {
+		if (idr->used[id] && idr->ptr[id]) {
+			*nextid = id;
+			return idr->ptr[id];
+		}
+	}
+
+	return NULL;
+}
+
+void idr_destroy(struct idr *idr)
+{
+	free(idr->ptr);
+	free(idr->used);
+	idr->ptr = NULL;
+	idr->used = NULL;
+	idr->size = 0;
+}
+
+/*****************************************
+ *  Network device
+ *****************************************/
+
+struct sk_buff *netdev_alloc_skb(struct net_device *dev, unsigned int len)
+{
+	struct sk_buff *skb = malloc(sizeof(*skb) + len);
+
+	if (!skb)
+		return NULL;
+
+	memset(skb, 0, sizeof(*skb));
+	skb->dev = dev;
+	skb->head = skb->data = (unsigned char *)(skb + 1);
+	skb->end = skb->head + len;
+	return skb;
+}
+
+int nla_put(struct sk_buff *skb, int attrtype, int attrlen, const void *data)
+{
+	struct nlattr *nla;
+
+	if (skb->data + skb->len + nla_total_size(attrlen) > skb->end)
+		return -EMSGSIZE;
+
+	nla = skb_put(skb, nla_total_size(attrlen));
+	nla->nla_type = attrtype;
+	nla->nla_len = NLA_HDRLEN + attrlen;
+	memcpy(nla_data(nla), data, attrlen);
+	return 0;
+}
+
+struct net_device *alloc_netdev(int sizeof_priv, const char *name,
+		unsigned char name_assign_type,
+		void (*setup)(struct net_device *))
+{
+	struct net_device *dev;
+
+	dev = calloc(1, SHIM_NETDEV_PRIV_OFFS + sizeof_priv);
+	if (!dev)
+		return NULL;
+
+	strncpy(dev->name, name, IFNAMSIZ - 1);
+	setup(dev);
+	return dev;
+}
+
+int register_netdevice(struct net_device *dev)
+{
+	if (shim_netdev)
+		return -EBUSY;
+
+	dev->ifindex = ++shim_ifindex;
+	set_bit(SHIM_DEV_REGISTERED, &dev->state);
+	shim_netdev = dev;
+	return 0;
+}
+
+void unregister_netdev(struct net_device *dev)
+{
+	shim_netdev_close(dev);
+	clear_bit(SHIM_DEV_REGISTERED, &dev->state);
+	if (shim_netdev == dev)
+		shim_netdev = NULL;
+	if (dev->destructor)
+		dev->destructor(dev);
+}
+
+int netif_rx(struct sk_buff *skb)
+{
+	if (shim_hooks.rx)
+		shim_hooks.rx(skb->dev, (struct can_frame *)skb->data);
+	kfree_skb(skb);
+	return 0;
+}
+
+int rtnl_link_register(struct rtnl_link_ops *ops)
+{
+	shim_link_ops = ops;
+	return 0;
+}
+
+void rtnl_link_unregister(struct rtnl_link_ops *ops)
+{
+	shim_link_ops = NULL;
+}
+
+struct net_device *shim_netdev_get(void)
+{
+	return shim_netdev;
+}
+
+int shim_netdev_open(struct net_device *dev)
+{
+	int ret;
+
+	if (netif_running(dev))
+		return 0;
+
+	/* Running already in ndo_open() as with __dev_open() */
+	set_bit(SHIM_DEV_RUNNING, &dev->state);
+	ret = dev->netdev_ops->ndo_open(dev);
+	if (ret)
+		clear_bit(SHIM_DEV_RUNNING, &dev->state);
+	return ret;
+}
+
+void shim_netdev_close(struct net_device *dev)
+{
+	if (!netif_running(dev))
+		return;
+
+	clear_bit(SHIM_DEV_RUNNING, &dev->state);
+	dev->netdev_ops->ndo_stop(dev);
+	shim_run_works();
+}
+
+int shim_netdev_xmit(struct net_device *dev, const struct can_frame *cf)
+{
+	struct sk_buff *skb;
+	int ret;
+
+	if (netif_queue_stopped(dev))
+		return -ENOBUFS;
+
+	skb = netdev_alloc_skb(dev, sizeof(*cf));
+	if (!skb)
+		return -ENOMEM;
+	memcpy(skb_put(skb, sizeof(*cf)), cf, sizeof(*cf));
+
+	ret = dev->netdev_ops->ndo_start_xmit(skb, dev);
+	shim_run_works();
+	return ret;
+}
+
+/* Change one IFLA_SLLIN_* attribute as "ip link set ... type sllin" does */
+int shim_changelink(struct net_device *dev, int attrtype, u32 value)
+{
+	struct {
+		struct nlattr nla;
+		u32 value;
+	} attr;
+	struct nlattr *data[64];
+	int ret;
+
+	if (!shim_link_ops || (attrtype <= 0) ||
+		(attrtype > shim_link_ops->maxtype))
+		return -EINVAL;
+
+	memset(data, 0, sizeof(data));
+	attr.nla.nla_type = attrtype;
+	if (shim_link_ops->policy[attrtype].type == NLA_U8) {
+		u8 v = value;
+
+		attr.nla.nla_len = NLA_HDRLEN + sizeof(v);
+		memcpy(nla_data(&attr.nla), &v, sizeof(v));
+	} else {
+		attr.nla.nla_len = NLA_HDRLEN + sizeof(value);
+		memcpy(nla_data(&attr.nla), &value, sizeof(value));
+	}
+	data[attrtype] = &attr.nla;
+
+	ret = shim_link_ops->validate(NULL, data);
+	if (ret)
+		return ret;
+	ret = shim_link_ops->changelink(dev, NULL, data);
+	shim_run_works();
+	return ret;
+}
+
+/*****************************************
+ *  TTY and the UART model
+ *****************************************/
+
+static s64 shim_uart_char_ns(struct shim_uart *u)
+{
+	speed_t baud = u->tty.termios.c_ospeed;
+
+	return (10 * NSEC_PER_SEC) / (baud ? baud : 9600);
+}
+
+static void shim_uart_put(struct shim_uart *u, ktime_t at, unsigned char c,
+		char flag, bool tx)
+{
+	struct shim_char *ch;
+
+	if (u->ch_head - u->ch_tail >= SHIM_ECHO_MAX)
+		shim_bug("UART echo queue overflow");
+
+	ch = &u->ch[u->ch_head++ % SHIM_ECHO_MAX];
+	ch->at = at;
+	ch->c = c;
+	ch->flag = flag;
+	ch->tx = tx;
+}
+
+static int shim_uart_write(struct tty_struct *tty, const unsigned char *buf,
+		int count)
+{
+	struct shim_uart *u = container_of(tty, struct shim_uart, tty);
+	s64 char_ns = shim_uart_char_ns(u);
+	int n;
+	int i;
+
+	/* Same as serial_core for count <= 0 */
+	n = min(count, u->fifo_size - u->fifo_used);
+	if (n <= 0)
+		return 0;
+
+	if (shim_hooks.wire)
+		shim_hooks.wire(buf, n);
+
+	for (i = 0; i < n; i++) {
+		ktime_t start = max(shim_now, u->wire_free);
+
+		u->wire_free = start + char_ns;
+		shim_uart_put(u, u->wire_free, buf[i], TTY_NORMAL, true);
+		u->fifo_used++;
+	}
+
+	return n;
+}
+
+static int shim_uart_break_ctl(struct tty_struct *tty, int state)
+{
+	struct shim_uart *u = container_of(tty, struct shim_uart, tty);
+
+	if (state && !u->brk) {
+		u->brk = true;
+	} else if (!state && u->brk) {
+		/* Reported by the receiver when the break ends */
+		u->brk = false;
+		u->wire_free = max(shim_now, u->wire_free);
+		shim_uart_put(u, u->wire_free, 0x00, TTY_BREAK, false);
+	} else {
+		return 0;
+	}
+
+	if (shim_hooks.brk)
+		shim_hooks.brk(u->brk);
+	return 0;
+}
+
+/* Drops the characters which did not start to be sent yet */
+static void shim_uart_flush_buffer(struct tty_struct *tty)
+{
+	struct shim_uart *u = container_of(tty, struct shim_uart, tty);
+	s64 char_ns = shim_uart_char_ns(u);
+
+	while (u->ch_head != u->ch_tail) {
+		struct shim_char *ch = &u->ch[(u->ch_head - 1) % SHIM_ECHO_MAX];
+
+		if (!ch->tx || (ch->at - char_ns <= shim_now))
+			break;
+		u->ch_head--;
+		u->fifo_used--;
+		u->wire_free = ch->at - char_ns;
+	}
+}
+
+static void shim_uart_set_termios(struct tty_struct *tty, struct ktermios *old)
+{
+	if (shim_hooks.baud && (tty->termios.c_ospeed != old->c_ospeed))
+		shim_hooks.baud(tty->termios.c_ospeed);
+}
+
+static const struct tty_operations shim_uart_ops = {
+	.write		= shim_uart_write,
+	.break_ctl	= shim_uart_break_ctl,
+	.flush_buffer	= shim_uart_flush_buffer,
+	.set_termios	= shim_uart_set_termios,
+};
+
+void tty_encode_baud_rate(struct tty_struct *tty, speed_t ibaud,
+		speed_t obaud)
+{
+	tty->termios.c_ispeed = ibaud;
+	tty->termios.c_ospeed = obaud;
+}
+
+/* Asynchronous in the kernel as well */
+void tty_hangup(struct tty_struct *tty)
+{
+	container_of(tty, struct shim_uart, tty)->hangup = true;
+}
+
+int tty_register_ldisc(int disc, struct tty_ldisc_ops *new_ldisc)
+{
+	if (disc != N_SLLIN)
+		return -EINVAL;
+	shim_ldisc = new_ldisc;
+	return 0;
+}
+
+int tty_unregister_ldisc(int disc)
+{
+	shim_ldisc = NULL;
+	return 0;
+}
+
+struct tty_struct *shim_tty_open(bool echo, int fifo_size)
+{
+	struct shim_uart *u = &shim_uart;
+	int ret;
+
+	if (!shim_ldisc || u->tty.disc_data)
+		return NULL;
+
+	memset(u, 0, sizeof(*u));
+	u->tty.ops = &shim_uart_ops;
+	u->echo = echo;
+	u->fifo_size = fifo_size;
+	u->wire_free = shim_now;
+
+	ret = shim_ldisc->open(&u->tty);
+	if (ret) {
+		fprintf(stderr, "sllin open failed: %s\n", strerror(-ret));
+		return NULL;
+	}
+
+	return &u->tty;
+}
+
+void shim_tty_close(struct tty_struct *tty)
+{
+	shim_ldisc->close(tty);
+	shim_run_works();
+}
+
+void shim_tty_rx(struct tty_struct *tty, const unsigned char *cp, char *fp,
+		int count)
+{
+	shim_ldisc->receive_buf2(tty, cp, fp, count);
+	shim_run_works();
+}
+
+int shim_tty_ioctl(struct tty_struct *tty, unsigned int cmd, void *arg)
+{
+	int ret;
+
+	ret = shim_ldisc->ioctl(tty, NULL, cmd, (unsigned long)arg);
+	shim_run_works();
+	return ret;
+}
+
+/*****************************************
+ *  seq_file (debugfs is not available)
+ *****************************************/
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	return 0;
+}
+
+int seq_putc(struct seq_file *m, char c)
+{
+	return 0;
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	return -ENODEV;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos)
+{
+	return -ENODEV;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return -ENODEV;
+}
@@ -0,0 +1,886 @@
+/*
+ * sllin_shim.h - Kernel API used by sllin.c emulated in userspace
+ *
+ * sllin.c compiled with -DSLLIN_USERSPACE includes this header instead
+ * of the kernel headers. The run-time part (virtual clock, hrtimers,
+ * workers, UART model of the tty and the network device) is in
+ * sllin_shim.c.
+ *
+ * Everything runs in a single thread. Time is virtual, it advances only
+ * when the replay harness asks for it (shim_run_until()) or when the
+ * driver sleeps. Timer handlers and works are executed from the event
+ * loop, never while another part of the driver is running, so spinlocks
+ * reduce to a check that they are not taken recursively.
+ */
+#ifndef _SLLIN_SHIM_H
+#define _SLLIN_SHIM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/types.h>
+
+#include <linux/types.h>
+#include <linux/can.h>
+#include <linux/netlink.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/sockios.h>
+#include <asm/termbits.h>
+
+/* Kernel the shim corresponds to (kthread_* names, no extack, destructor) */
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(4, 9, 0)
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned int gfp_t;
+typedef s64 ktime_t;
+
+/*****************************************
+ *  Compiler, module and printk
+ *****************************************/
+
+#define __init
+#define __exit
+#define __initdata
+#define __read_mostly
+#define __user
+
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define BITS_PER_LONG		(8 * (int)sizeof(long))
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define BIT(nr)			(1UL << (nr))
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)		((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi)	min_t(t, max_t(t, v, lo), hi)
+
+#define THIS_MODULE		NULL
+#define MODULE_ALIAS_LDISC(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_PARM_DESC(p, d)
+#define module_param(p, t, perm)
+
+/* Entry points of the "module" for the harness */
+#define module_init(fn)		int shim_module_init(void) { return fn(); }
+#define module_exit(fn)		void shim_module_exit(void) { fn(); }
+int shim_module_init(void);
+void shim_module_exit(void);
+
+#define KERN_INFO		""
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+#define pr_err(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define netdev_err(dev, fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define netdev_warn(dev, fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define netdev_info(dev, fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#ifdef DEBUG
+#define pr_debug(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define netdev_dbg(dev, fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#else
+#define pr_debug(fmt, ...) \
+	do { if (0) printk(fmt, ##__VA_ARGS__); } while (0)
+#define netdev_dbg(dev, fmt, ...) \
+	do { if (0) printk(fmt, ##__VA_ARGS__); } while (0)
+#endif
+
+void shim_bug(const char *what) __attribute__((noreturn));
+
+/*****************************************
+ *  Memory and user copies
+ *****************************************/
+
+#define GFP_KERNEL		0
+#define GFP_ATOMIC		1
+#define GFP_NOWAIT		2
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	return calloc(n, size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+#define ERR_PTR(err)		((void *)(long)(err))
+#define IS_ERR(p)		((unsigned long)(p) >= (unsigned long)-4095)
+
+/* The harness passes plain pointers as ioctl arguments */
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+		unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+		unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+#define get_user(x, p)		({ (x) = *(p); 0; })
+#define put_user(x, p)		({ *(p) = (x); 0; })
+
+#define CAP_NET_ADMIN		12
+#define capable(cap)		1
+
+#define ENOIOCTLCMD		515
+#define ERESTARTSYS		512
+
+/*****************************************
+ *  Bit operations (single threaded)
+ *****************************************/
+
+static inline void set_bit(int nr, volatile unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void clear_bit(int nr, volatile unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(int nr, const volatile unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	set_bit(nr, addr);
+	return old;
+}
+
+static inline int test_and_clear_bit(int nr, volatile unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	clear_bit(nr, addr);
+	return old;
+}
+
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+#define barrier()		__asm__ __volatile__("" : : : "memory")
+#define smp_mb()		barrier()
+#define smp_wmb()		barrier()
+#define smp_rmb()		barrier()
+#define smp_mb__after_atomic()	barrier()
+#define smp_mb__after_clear_bit() barrier()
+
+/*****************************************
+ *  Locking
+ *****************************************/
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(x)	spinlock_t x = { 0 }
+
+static inline void spin_lock_init(spinlock_t *l)
+{
+	l->locked = 0;
+}
+
+/* Would deadlock in the kernel */
+static inline void spin_lock(spinlock_t *l)
+{
+	if (l->locked)
+		shim_bug("recursive spin_lock");
+	l->locked = 1;
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+	if (!l->locked)
+		shim_bug("spin_unlock of unlocked lock");
+	l->locked = 0;
+}
+
+#define spin_lock_bh(l)		spin_lock(l)
+#define spin_unlock_bh(l)	spin_unlock(l)
+#define spin_lock_irqsave(l, f)	do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void)(f); spin_unlock(l); } while (0)
+
+struct mutex {
+	int locked;
+};
+
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_lock(m)		((m)->locked = 1)
+#define mutex_unlock(m)		((m)->locked = 0)
+#define mutex_lock_interruptible(m) ({ (m)->locked = 1; 0; })
+
+struct rw_semaphore {
+	int locked;
+};
+
+#define down_write(s)		((s)->locked = 1)
+#define up_write(s)		((s)->locked = 0)
+
+typedef struct {
+	unsigned sequence;
+} seqcount_t;
+
+#define seqcount_init(s)	((s)->sequence = 0)
+#define read_seqcount_begin(s)	((s)->sequence & ~1U)
+#define read_seqcount_retry(s, start) ((s)->sequence != (start))
+#define write_seqcount_begin(s)	((s)->sequence++)
+#define write_seqcount_end(s)	((s)->sequence++)
+
+#define rtnl_lock()		do { } while (0)
+#define rtnl_unlock()		do { } while (0)
+
+/* Timer handlers are the only "interrupts" */
+extern int shim_in_irq;
+#define in_irq()		(shim_in_irq)
+#define irqs_disabled()		0
+#define local_bh_disable()	do { } while (0)
+#define local_bh_enable()	do { } while (0)
+
+/*****************************************
+ *  Virtual time
+ *****************************************/
+
+#define NSEC_PER_SEC		1000000000L
+#define NSEC_PER_MSEC		1000000L
+#define NSEC_PER_USEC		1000L
+#define HZ			100
+
+extern ktime_t shim_now;
+
+#define ktime_get()		(shim_now)
+#define ktime_get_real()	(shim_now)
+#define ktime_mono_to_real(kt)	(kt)
+#define ktime_set(s, ns)	((ktime_t)(s) * NSEC_PER_SEC + (ns))
+#define ns_to_ktime(ns)		((ktime_t)(ns))
+#define ktime_to_ns(kt)		((s64)(kt))
+#define ktime_add(a, b)		((a) + (b))
+#define ktime_sub(a, b)		((a) - (b))
+#define ktime_add_us(kt, us)	((kt) + (s64)(us) * NSEC_PER_USEC)
+#define ktime_us_delta(a, b)	(((a) - (b)) / NSEC_PER_USEC)
+#define ktime_compare(a, b)	((a) < (b) ? -1 : ((a) > (b) ? 1 : 0))
+#define ktime_after(a, b)	((a) > (b))
+#define ktime_before(a, b)	((a) < (b))
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+#define jiffies			((unsigned long)(shim_now / (NSEC_PER_SEC / HZ)))
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+
+/* Sleeping lets the virtual time pass, timers and echoes are processed */
+void shim_sleep(s64 ns);
+bool shim_step(void);
+
+static inline void usleep_range(unsigned long min, unsigned long max)
+{
+	shim_sleep((s64)min * NSEC_PER_USEC);
+}
+
+static inline unsigned long msleep_interruptible(unsigned int msecs)
+{
+	shim_sleep((s64)msecs * NSEC_PER_MSEC);
+	return 0;
+}
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS = 0,
+	HRTIMER_MODE_REL = 1,
+};
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+#define CLOCK_MONOTONIC		1
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *);
+	ktime_t expires;
+	bool queued;
+	struct hrtimer *next;
+};
+
+void hrtimer_init(struct hrtimer *timer, int clock, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+#define hrtimer_cancel(t)	hrtimer_try_to_cancel(t)
+#define hrtimer_get_expires(t)	((t)->expires)
+#define hrtimer_set_expires(t, kt) ((t)->expires = (kt))
+#define hrtimer_is_queued(t)	((t)->queued)
+
+/*****************************************
+ *  Wait queues, kthreads and workers
+ *****************************************/
+
+typedef struct {
+	int dummy;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(q)	((q)->dummy = 0)
+#define wake_up(q)		do { } while (0)
+#define wake_up_interruptible(q) do { } while (0)
+
+/* Process events until the condition holds or nothing is left to do */
+#define wait_event_interruptible(wq, cond) ({		\
+	while (!(cond) && shim_step())			\
+		;					\
+	(cond) ? 0 : -ERESTARTSYS; })
+#define wait_event_killable(wq, cond)	wait_event_interruptible(wq, cond)
+
+struct task_struct {
+	int dummy;
+};
+
+struct sched_param {
+	int sched_priority;
+};
+
+#define SCHED_FIFO		1
+
+struct kthread_work;
+typedef void (*kthread_work_func_t)(struct kthread_work *work);
+
+struct kthread_worker {
+	int dummy;
+};
+
+struct kthread_work {
+	kthread_work_func_t func;
+	struct kthread_work *next;
+	bool queued;
+};
+
+#define kthread_init_worker(w)	((w)->dummy = 0)
+#define kthread_init_work(w, fn) \
+	do { (w)->func = (fn); (w)->next = NULL; (w)->queued = false; } while (0)
+bool kthread_queue_work(struct kthread_worker *worker,
+			struct kthread_work *work);
+void kthread_flush_work(struct kthread_work *work);
+int kthread_worker_fn(void *worker_ptr);
+struct task_struct *kthread_create_on_node(int (*threadfn)(void *data),
+		void *data, int node, const char namefmt[], ...);
+
+static inline void kthread_bind(struct task_struct *k, unsigned int cpu)
+{
+}
+
+static inline int kthread_stop(struct task_struct *k)
+{
+	return 0;
+}
+
+static inline int wake_up_process(struct task_struct *p)
+{
+	return 1;
+}
+
+static inline int sched_setscheduler(struct task_struct *p, int policy,
+		const struct sched_param *param)
+{
+	return 0;
+}
+
+#define num_online_cpus()	1
+#define for_each_online_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define cpu_to_node(cpu)	0
+
+/*****************************************
+ *  IDR
+ *****************************************/
+
+struct idr {
+	void **ptr;
+	bool *used;
+	int size;
+};
+
+#define DEFINE_IDR(name)	struct idr name = { NULL, NULL, 0 }
+#define idr_preload(gfp)	do { } while (0)
+#define idr_preload_end()	do { } while (0)
+
+int idr_alloc(struct idr *idr, void *ptr, int start, int end, gfp_t gfp);
+void *idr_find(struct idr *idr, int id);
+void *idr_replace(struct idr *idr, void *ptr, int id);
+void *idr_remove(struct idr *idr, int id);
+void *idr_get_next(struct idr *idr, int *nextid);
+void idr_destroy(struct idr *idr);
+
+#define idr_for_each_entry(idr, entry, id)			\
+	for ((id) = 0; ((entry) = idr_get_next(idr, &(id))) != NULL; ++(id))
+
+/*****************************************
+ *  Socket buffers
+ *****************************************/
+
+struct net_device;
+
+struct skb_shared_hwtstamps {
+	ktime_t hwtstamp;
+};
+
+struct sk_buff {
+	struct sk_buff *next;
+	struct sk_buff *prev;
+	struct net_device *dev;
+	ktime_t tstamp;
+	struct skb_shared_hwtstamps hwtstamps;
+	__be16 protocol;
+	u8 pkt_type;
+	u8 ip_summed;
+	unsigned int len;
+	unsigned char *head;
+	unsigned char *data;
+	unsigned char *end;
+};
+
+struct sk_buff_head {
+	struct sk_buff *next;
+	struct sk_buff *prev;
+	u32 qlen;
+};
+
+#define CHECKSUM_UNNECESSARY	1
+#define htons(x)		htobe16(x)
+
+struct sk_buff *netdev_alloc_skb(struct net_device *dev, unsigned int len);
+#define kfree_skb(skb)		free(skb)
+#define skb_hwtstamps(skb)	(&(skb)->hwtstamps)
+
+static inline void skb_reserve(struct sk_buff *skb, int len)
+{
+	skb->data += len;
+}
+
+static inline void *skb_put(struct sk_buff *skb, unsigned int len)
+{
+	void *tmp = skb->data + skb->len;
+
+	if (skb->data + skb->len + len > skb->end)
+		shim_bug("skb_put over end");
+	skb->len += len;
+	return tmp;
+}
+
+static inline void __skb_queue_head_init(struct sk_buff_head *list)
+{
+	list->prev = list->next = (struct sk_buff *)list;
+	list->qlen = 0;
+}
+
+#define skb_queue_head_init(list) __skb_queue_head_init(list)
+#define skb_queue_empty(list)	((list)->next == (const struct sk_buff *)(list))
+#define skb_queue_len(list)	((list)->qlen)
+#define skb_peek(list)		(skb_queue_empty(list) ? NULL : (list)->next)
+
+static inline void __skb_queue_tail(struct sk_buff_head *list,
+		struct sk_buff *skb)
+{
+	skb->next = (struct sk_buff *)list;
+	skb->prev = list->prev;
+	list->prev->next = skb;
+	list->prev = skb;
+	list->qlen++;
+}
+
+#define skb_queue_tail(list, skb) __skb_queue_tail(list, skb)
+
+static inline struct sk_buff *__skb_dequeue(struct sk_buff_head *list)
+{
+	struct sk_buff *skb = skb_peek(list);
+
+	if (skb) {
+		list->next = skb->next;
+		skb->next->prev = (struct sk_buff *)list;
+		skb->next = skb->prev = NULL;
+		list->qlen--;
+	}
+	return skb;
+}
+
+#define skb_dequeue(list)	__skb_dequeue(list)
+
+static inline void skb_queue_purge(struct sk_buff_head *list)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(list)) != NULL)
+		kfree_skb(skb);
+}
+
+static inline void skb_queue_splice_tail_init(struct sk_buff_head *list,
+		struct sk_buff_head *head)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(list)) != NULL)
+		__skb_queue_tail(head, skb);
+}
+
+struct can_skb_priv {
+	int ifindex;
+	int skbcnt;
+	struct can_frame cf[0];
+};
+
+#define can_skb_reserve(skb)	skb_reserve(skb, sizeof(struct can_skb_priv))
+#define can_skb_prv(skb)	((struct can_skb_priv *)(skb)->head)
+
+/*****************************************
+ *  Network device
+ *****************************************/
+
+typedef int netdev_tx_t;
+#define NETDEV_TX_OK		0
+#define NETIF_F_HW_CSUM		(1 << 3)
+#define NET_NAME_UNKNOWN	0
+
+struct net_device_stats {
+	unsigned long rx_packets;
+	unsigned long tx_packets;
+	unsigned long rx_bytes;
+	unsigned long tx_bytes;
+	unsigned long rx_errors;
+	unsigned long tx_errors;
+	unsigned long rx_dropped;
+	unsigned long tx_dropped;
+	unsigned long collisions;
+	unsigned long rx_over_errors;
+	unsigned long rx_crc_errors;
+	unsigned long rx_frame_errors;
+	unsigned long rx_fifo_errors;
+	unsigned long rx_missed_errors;
+};
+
+struct net_device_ops {
+	int (*ndo_open)(struct net_device *dev);
+	int (*ndo_stop)(struct net_device *dev);
+	netdev_tx_t (*ndo_start_xmit)(struct sk_buff *skb,
+				      struct net_device *dev);
+	int (*ndo_change_mtu)(struct net_device *dev, int new_mtu);
+};
+
+#define ETH_GSTRING_LEN		32
+#define ETH_SS_STATS		1
+
+struct ethtool_stats {
+	u32 cmd;
+	u32 n_stats;
+};
+
+struct ethtool_ops {
+	void (*get_strings)(struct net_device *dev, u32 sset, u8 *data);
+	int (*get_sset_count)(struct net_device *dev, int sset);
+	void (*get_ethtool_stats)(struct net_device *dev,
+				  struct ethtool_stats *stats, u64 *data);
+};
+
+struct rtnl_link_ops;
+struct list_head;
+
+struct net_device {
+	char name[IFNAMSIZ];
+	unsigned long state;
+	unsigned long base_addr;
+	int ifindex;
+	unsigned int flags;
+	unsigned long features;
+	unsigned int mtu;
+	unsigned short type;
+	unsigned short hard_header_len;
+	unsigned char addr_len;
+	unsigned long tx_queue_len;
+	struct net_device_stats stats;
+	const struct net_device_ops *netdev_ops;
+	const struct ethtool_ops *ethtool_ops;
+	const struct rtnl_link_ops *rtnl_link_ops;
+	void (*destructor)(struct net_device *dev);
+};
+
+/* Bits of net_device::state */
+#define SHIM_DEV_REGISTERED	0
+#define SHIM_DEV_RUNNING	1
+#define SHIM_DEV_QUEUE_STOPPED	2
+
+#define NETDEV_ALIGN		32
+#define SHIM_NETDEV_PRIV_OFFS	\
+	((sizeof(struct net_device) + NETDEV_ALIGN - 1) & ~(NETDEV_ALIGN - 1))
+#define netdev_priv(dev)	((void *)((char *)(dev) + SHIM_NETDEV_PRIV_OFFS))
+
+struct net_device *alloc_netdev(int sizeof_priv, const char *name,
+		unsigned char name_assign_type,
+		void (*setup)(struct net_device *));
+#define free_netdev(dev)	free(dev)
+int register_netdevice(struct net_device *dev);
+void unregister_netdev(struct net_device *dev);
+
+#define netif_running(dev)	test_bit(SHIM_DEV_RUNNING, &(dev)->state)
+#define netif_start_queue(dev)	clear_bit(SHIM_DEV_QUEUE_STOPPED, &(dev)->state)
+#define netif_wake_queue(dev)	clear_bit(SHIM_DEV_QUEUE_STOPPED, &(dev)->state)
+#define netif_stop_queue(dev)	set_bit(SHIM_DEV_QUEUE_STOPPED, &(dev)->state)
+#define netif_queue_stopped(dev) test_bit(SHIM_DEV_QUEUE_STOPPED, &(dev)->state)
+
+int netif_rx(struct sk_buff *skb);
+#define netif_receive_skb(skb)	netif_rx(skb)
+
+/*****************************************
+ *  Netlink
+ *****************************************/
+
+enum {
+	NLA_UNSPEC,
+	NLA_U8,
+	NLA_U16,
+	NLA_U32,
+	NLA_U64,
+};
+
+struct nla_policy {
+	u16 type;
+	u16 len;
+};
+
+struct net;
+
+#define nla_data(nla)		((void *)((char *)(nla) + NLA_HDRLEN))
+#define nla_get_u8(nla)		(*(u8 *)nla_data(nla))
+#define nla_get_u32(nla)	(*(u32 *)nla_data(nla))
+#define nla_total_size(payload)	NLA_ALIGN(NLA_HDRLEN + (payload))
+
+int nla_put(struct sk_buff *skb, int attrtype, int attrlen, const void *data);
+
+static inline int nla_put_u8(struct sk_buff *skb, int attrtype, u8 value)
+{
+	return nla_put(skb, attrtype, sizeof(u8), &value);
+}
+
+static inline int nla_put_u32(struct sk_buff *skb, int attrtype, u32 value)
+{
+	return nla_put(skb, attrtype, sizeof(u32), &value);
+}
+
+struct rtnl_link_ops {
+	const char *kind;
+	size_t priv_size;
+	void (*setup)(struct net_device *dev);
+	int maxtype;
+	const struct nla_policy *policy;
+	int (*validate)(struct nlattr *tb[], struct nlattr *data[]);
+	int (*newlink)(struct net *src_net, struct net_device *dev,
+		       struct nlattr *tb[], struct nlattr *data[]);
+	int (*changelink)(struct net_device *dev, struct nlattr *tb[],
+			  struct nlattr *data[]);
+	void (*dellink)(struct net_device *dev, struct list_head *head);
+	size_t (*get_size)(const struct net_device *dev);
+	int (*fill_info)(struct sk_buff *skb, const struct net_device *dev);
+};
+
+int rtnl_link_register(struct rtnl_link_ops *ops);
+void rtnl_link_unregister(struct rtnl_link_ops *ops);
+
+/*****************************************
+ *  TTY
+ *****************************************/
+
+#define TTY_LDISC_MAGIC		0x5403
+#define TTY_DO_WRITE_WAKEUP	5
+
+/* Flags of received characters */
+#define TTY_NORMAL		0
+#define TTY_BREAK		1
+#define TTY_FRAME		2
+#define TTY_PARITY		3
+#define TTY_OVERRUN		4
+
+struct tty_struct;
+struct file;
+
+struct tty_operations {
+	int (*write)(struct tty_struct *tty, const unsigned char *buf,
+		     int count);
+	int (*break_ctl)(struct tty_struct *tty, int state);
+	void (*flush_buffer)(struct tty_struct *tty);
+	void (*set_termios)(struct tty_struct *tty, struct ktermios *old);
+};
+
+struct tty_struct {
+	int index;
+	const struct tty_operations *ops;
+	void *disc_data;
+	unsigned long flags;
+	int receive_room;
+	struct ktermios termios;
+	struct rw_semaphore termios_rwsem;
+};
+
+struct tty_ldisc_ops {
+	int magic;
+	const char *name;
+	void *owner;
+	int (*open)(struct tty_struct *tty);
+	void (*close)(struct tty_struct *tty);
+	int (*hangup)(struct tty_struct *tty);
+	int (*ioctl)(struct tty_struct *tty, struct file *file,
+		     unsigned int cmd, unsigned long arg);
+	int (*receive_buf2)(struct tty_struct *tty, const unsigned char *cp,
+			    char *fp, int count);
+	void (*write_wakeup)(struct tty_struct *tty);
+};
+
+#define tty_devnum(tty)		((dev_t)(tty)->index)
+#define tty_mode_ioctl(tty, file, cmd, arg) (-ENOIOCTLCMD)
+
+void tty_encode_baud_rate(struct tty_struct *tty, speed_t ibaud,
+		speed_t obaud);
+void tty_hangup(struct tty_struct *tty);
+int tty_register_ldisc(int disc, struct tty_ldisc_ops *new_ldisc);
+int tty_unregister_ldisc(int disc);
+
+/*****************************************
+ *  debugfs and seq_file (no files are created)
+ *****************************************/
+
+#define S_IRUGO			0444
+
+struct dentry;
+
+struct inode {
+	void *i_private;
+};
+
+struct seq_file {
+	void *private;
+};
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char __user *buf, size_t size,
+			loff_t *ppos);
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+		struct dentry *parent)
+{
+	return NULL;
+}
+
+static inline struct dentry *debugfs_create_file(const char *name, int mode,
+		struct dentry *parent, void *data,
+		const struct file_operations *fops)
+{
+	return NULL;
+}
+
+static inline void debugfs_remove(struct dentry *dentry)
+{
+}
+
+#define debugfs_remove_recursive(dentry)	debugfs_remove(dentry)
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int seq_putc(struct seq_file *m, char c);
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+
+/*****************************************
+ *  Tracepoints compile to nothing
+ *****************************************/
+
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+
+/*****************************************
+ *  Harness side of the shim
+ *****************************************/
+
+/* Called when the driver drives the bus or passes a frame up */
+struct shim_hooks {
+	void (*wire)(const unsigned char *buf, int count);
+	void (*brk)(int on);
+	void (*baud)(unsigned int baud);
+	void (*rx)(struct net_device *dev, const struct can_frame *cf);
+};
+
+extern struct shim_hooks shim_hooks;
+
+/*
+ * UART model: characters written by the driver occupy the wire for
+ * 10 bit times each and are echoed back (as the LIN transceiver does)
+ * when they leave the wire. At most fifo_size characters might wait
+ * for the wire, the rest is left to write_wakeup.
+ */
+struct tty_struct *shim_tty_open(bool echo, int fifo_size);
+void shim_tty_close(struct tty_struct *tty);
+void shim_tty_rx(struct tty_struct *tty, const unsigned char *cp, char *fp,
+		int count);
+int shim_tty_ioctl(struct tty_struct *tty, unsigned int cmd, void *arg);
+
+struct net_device *shim_netdev_get(void);
+int shim_netdev_open(struct net_device *dev);
+void shim_netdev_close(struct net_device *dev);
+int shim_netdev_xmit(struct net_device *dev, const struct can_frame *cf);
+int shim_changelink(struct net_device *dev, int attrtype, u32 value);
+
+void shim_run_until(ktime_t t);
+
+#endif /* _SLLIN_SHIM_H */
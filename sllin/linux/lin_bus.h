@@ -1,6 +1,9 @@
 #ifndef _LIN_BUS_H_
 #define _LIN_BUS_H_
 
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
 #define LIN_ID_MASK		0x3f
 #define LIN_ID_MAX		LIN_ID_MASK
 #define LIN_CTRL_FRAME 		CAN_EFF_FLAG
@@ -19,4 +22,129 @@
 #define LIN_ERR_CHECKSUM	(1 << (LIN_CANFR_FLAGS_OFFS + 9))
 #define LIN_ERR_FRAMING		(1 << (LIN_CANFR_FLAGS_OFFS + 10))
 
+/* Schedule tables executed by the driver (Master mode only) */
+#define LIN_SCHED_TABLES_MAX	4
+#define LIN_SCHED_SLOTS_MAX	64
+
+#define LIN_SCHED_TABLE_NORMAL		0
+#define LIN_SCHED_TABLE_DIAGNOSTIC	1
+#define LIN_SCHED_TABLE_COLLISION	2
+#define LIN_SCHED_TABLE_NONE		(-1) /* Stops the schedule */
+
+#define LIN_SCHED_SPORADIC_MAX	8
+
+/* lin_sched_slot.flags */
+#define LIN_SCHED_SLOT_SPORADIC	(1 << 0) /* Sporadic slot -- sends the first
+					    of sporadic[] frames updated in
+					    the frame cache since last sent */
+
+struct lin_sched_slot {
+	__u32 delay_us;		/* Time from the start of this slot
+				   to the start of the next one */
+	__u8 lin_id;		/* LIN ID of the header sent in this slot */
+	__u8 flags;		/* LIN_SCHED_SLOT_* */
+	__u8 sporadic_cnt;	/* Number of valid entries in sporadic[] */
+	__u8 reserved;
+	__u8 sporadic[LIN_SCHED_SPORADIC_MAX]; /* Candidate IDs of sporadic
+				   slot, the highest priority first */
+};
+
+struct lin_sched_table {
+	__u32 table;		/* Index of the table to be loaded */
+	__u32 slots_cnt;	/* Number of valid entries in slot[] */
+	struct lin_sched_slot slot[LIN_SCHED_SLOTS_MAX];
+};
+
+/* Whole frame cache, loaded or dumped by one ioctl() */
+struct lin_cache_entry {
+	__u32 frame_fl;		/* LIN_CACHE_RESPONSE, LIN_CHECKSUM_EXTENDED,
+				   LIN_SINGLE_RESPONSE */
+	__u8 dlc;		/* Length of data, 0 when unknown */
+	__u8 reserved[3];
+	__u8 data[8];
+};
+
+struct lin_cache {
+	struct lin_cache_entry entry[LIN_ID_MAX + 1]; /* Indexed by LIN ID */
+};
+
+/* Diagnostic transport layer (ISO 17987-2), Master mode only */
+#define LIN_DIAG_MASTER_REQ_ID	0x3c
+#define LIN_DIAG_SLAVE_RESP_ID	0x3d
+#define LIN_DIAG_PDU_MAX	4095
+#define LIN_DIAG_NAD_FUNCTIONAL	0x7e
+
+/* lin_diag_transfer.flags */
+#define LIN_DIAG_NO_RESPONSE	(1 << 0) /* Do not wait for any response */
+
+struct lin_diag_transfer {
+	__u8 nad;		/* Request: target NAD, response: NAD of slave */
+	__u8 flags;		/* LIN_DIAG_* */
+	__u16 len;		/* Length of data[] (SID included) */
+	__u32 p2_min_us;	/* Time between the request and the first
+				   slave response header (0 = 50 ms) */
+	__u32 p2_max_ms;	/* Max. time to the first response frame
+				   (0 = 1000 ms) */
+	__u32 n_cr_ms;		/* Max. time between response frames
+				   (0 = 1000 ms) */
+	__u8 data[LIN_DIAG_PDU_MAX];
+};
+
+/* Event triggered frames with collision resolution (Master mode only) */
+#define LIN_EVT_ASSOC_MAX	16
+
+struct lin_evt_frame {
+	__u8 lin_id;		/* ID of the event triggered frame */
+	__u8 assoc_cnt;		/* Number of valid entries in assoc[],
+				   0 removes the configuration */
+	__u8 reserved[2];
+	__u8 assoc[LIN_EVT_ASSOC_MAX]; /* IDs of the associated unconditional
+				   frames in the order of resolution */
+};
+
+/* Response timeout of one LIN ID */
+struct lin_resp_timeout {
+	__u8 lin_id;
+	__u8 reserved[3];
+	__u32 timeout_us;	/* 0 = computed from the response length
+				   and the baudrate */
+};
+
+/* rtnetlink attributes of "sllin" link kind (IFLA_INFO_DATA) */
+enum {
+	IFLA_SLLIN_UNSPEC,
+	IFLA_SLLIN_MASTER,	/* u8, 1 = Master, 0 = Slave */
+	IFLA_SLLIN_BITRATE,	/* u32, bits per second */
+	IFLA_SLLIN_TIMEOUT,	/* u32, header timeout in microseconds,
+				   0 = 24 characters */
+	IFLA_SLLIN_AUTOBAUD,	/* u8, detect the baudrate (Slave mode) */
+	IFLA_SLLIN_MONITOR,	/* u8, listen only, never transmits */
+	__IFLA_SLLIN_MAX
+};
+
+#define IFLA_SLLIN_MAX	(__IFLA_SLLIN_MAX - 1)
+
+/* ioctl()s on the TTY with sllin line discipline attached */
+#define SLLIN_IOC_MAGIC			'L'
+/* Load (or replace) one schedule table */
+#define SLLIN_IOC_SCHED_SET_TABLE	_IOW(SLLIN_IOC_MAGIC, 1, struct lin_sched_table)
+/* Switch to the table with given index at the next slot boundary,
+   LIN_SCHED_TABLE_NONE stops the schedule */
+#define SLLIN_IOC_SCHED_SWITCH		_IOW(SLLIN_IOC_MAGIC, 2, int)
+/* Serve the channel by the worker thread running on given CPU,
+   -1 selects one automatically; the interface has to be down */
+#define SLLIN_IOC_SET_CPU		_IOW(SLLIN_IOC_MAGIC, 3, int)
+/* Replace all frame cache entries at once */
+#define SLLIN_IOC_CACHE_LOAD		_IOW(SLLIN_IOC_MAGIC, 4, struct lin_cache)
+/* Read all frame cache entries */
+#define SLLIN_IOC_CACHE_DUMP		_IOR(SLLIN_IOC_MAGIC, 5, struct lin_cache)
+/* Send diagnostic request and wait for the response; the same
+   structure holds the response on return */
+#define SLLIN_IOC_DIAG_TRANSFER		_IOWR(SLLIN_IOC_MAGIC, 6, struct lin_diag_transfer)
+
+/* Configure one event triggered frame */
+#define SLLIN_IOC_EVT_SET		_IOW(SLLIN_IOC_MAGIC, 7, struct lin_evt_frame)
+/* Override response timeout of one LIN ID */
+#define SLLIN_IOC_SET_RESP_TIMEOUT	_IOW(SLLIN_IOC_MAGIC, 8, struct lin_resp_timeout)
+
 #endif /* _LIN_BUS_H_ */
@@ -44,6 +44,10 @@
 //#define DEBUG			1 /* Enables pr_debug() printouts */
 //#define SLLIN_LED_TRIGGER /* Enables led triggers */
 
+#ifdef SLLIN_USERSPACE
+/* Userspace build on top of the shim in misc/sllin_user */
+#include "sllin_shim.h"
+#else
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 
@@ -60,12 +64,23 @@
 #include <linux/sched.h>
 #include <linux/delay.h>
 #include <linux/init.h>
+#include <linux/version.h>
 #include <linux/can.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0)
+#include <linux/can/skb.h>
+#endif
 #include <linux/kthread.h>
 #include <linux/hrtimer.h>
-#include <linux/version.h>
+#include <linux/ethtool.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <net/rtnetlink.h>
+#endif /* SLLIN_USERSPACE */
 #include "linux/lin_bus.h"
 
+#define CREATE_TRACE_POINTS
+#include "sllin_trace.h"
+
 /* Should be in include/linux/tty.h */
 #define N_SLLIN			25
 /* -------------------------------- */
@@ -106,11 +121,20 @@ MODULE_PARM_DESC(master, "LIN interface is Master device");
 module_param(baudrate, int, 0444);
 MODULE_PARM_DESC(baudrate, "Baudrate of LIN interface");
 
-static int maxdev = 10;		/* MAX number of SLLIN channels;
-				   This can be overridden with
-				   insmod sllin.ko maxdev=nnn	*/
-module_param(maxdev, int, 0444);
-MODULE_PARM_DESC(maxdev, "Maximum number of sllin interfaces");
+static int rtprio = 40;		/* SCHED_FIFO priority of worker threads */
+module_param(rtprio, int, 0444);
+MODULE_PARM_DESC(rtprio, "Real-time priority of sllin worker threads");
+
+static int workers;		/* Size of the worker pool, 0 for one per CPU */
+module_param(workers, int, 0444);
+MODULE_PARM_DESC(workers, "Number of sllin worker threads (default one per online CPU)");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 9, 0)
+#define kthread_init_worker	init_kthread_worker
+#define kthread_init_work	init_kthread_work
+#define kthread_queue_work	queue_kthread_work
+#define kthread_flush_work	flush_kthread_work
+#endif
 
 /* maximum buffer len to store whole LIN message*/
 #define SLLIN_DATA_MAX		8
@@ -123,6 +147,64 @@ MODULE_PARM_DESC(maxdev, "Maximum number of sllin interfaces");
 
 #define SLLIN_SAMPLES_PER_CHAR	10
 #define SLLIN_CHARS_TO_TIMEOUT	24
+/* Receive FIFO timeout of 16550-like UARTs delays the last bytes */
+#define SLLIN_RX_LATENCY_CHARS	4
+
+/* Number of CAN frames queued in the driver before the netdev queue
+   is stopped */
+#define SLLIN_TX_QUEUE_LEN	16
+
+/* Timestamps of the phases of received LIN frame (rx_ts[]) */
+#define SLLIN_TS_BREAK		0	/* Break detected */
+#define SLLIN_TS_PID		1	/* PID received */
+#define SLLIN_TS_DATA_FIRST	2	/* First byte of the response */
+#define SLLIN_TS_DATA_LAST	3	/* Last byte received so far */
+#define SLLIN_TS_CNT		4
+#define SLLIN_TS_NONE		(-1)
+
+/* Diagnostic transport layer -- struct sllin_diag.state */
+#define SLLIN_DIAG_NONE		0
+#define SLLIN_DIAG_REQ		1	/* Sending master request frames */
+#define SLLIN_DIAG_REQ_SENT	2	/* Last request frame on the bus */
+#define SLLIN_DIAG_RESP		3	/* Polling slave response frames */
+#define SLLIN_DIAG_DONE		4	/* Result is ready */
+
+#define SLLIN_DIAG_P2_MIN_US	50000
+#define SLLIN_DIAG_P2_MAX_MS	1000
+#define SLLIN_DIAG_N_CR_MS	1000
+
+/* Diagnostic transfer in progress, protected by sm_lock */
+struct sllin_diag {
+	int			state;		/* SLLIN_DIAG_* */
+	int			result;
+	struct lin_diag_transfer *xfer;	/* Request, then response */
+	int			req_pos;	/* Request bytes already sent */
+	u8			req_sn;		/* Sequence number of next CF */
+	int			resp_pos;	/* Response bytes received */
+	int			resp_len;	/* 0 until SF/FF is received */
+	u8			resp_sn;	/* Expected CF sequence number */
+	bool			polled;		/* Response header sent ... */
+	bool			got_frame;	/* ... and answered */
+	ktime_t			next_poll;
+	ktime_t			deadline;	/* P2_max or N_Cr */
+	ktime_t			p2_min;
+	ktime_t			p2_max;
+	ktime_t			n_cr;
+};
+
+/* Event triggered frame configuration */
+struct sllin_evt {
+	int assoc_cnt;		/* 0 for ordinary frames */
+	u8 assoc[LIN_EVT_ASSOC_MAX]; /* Associated unconditional frames */
+};
+
+enum sllin_break_phase {
+	SLLIN_BREAK_NONE = 0,
+	SLLIN_BREAK_ASSERTED,	/* Waiting for the end of the break (for the
+				   echo of the break character in
+				   BREAK_BY_BAUD) */
+	SLLIN_BREAK_DELIMITER,	/* Waiting for the end of the delimiter */
+};
 
 enum slstate {
 	SLSTATE_IDLE = 0,
@@ -137,10 +219,37 @@ enum slstate {
 };
 
 struct sllin_conf_entry {
+	seqcount_t seq;		/* Lockless readers, writers hold linfr_lock */
 	int dlc;		/* Length of data in LIN frame */
 	canid_t frame_fl;	/* LIN frame flags. Passed from userspace as
 				   canid_t data type */
 	u8 data[8];		/* LIN frame data payload */
+	u8 resp[SLLIN_DATA_MAX + 1]; /* data + checksum ready to be sent */
+	int csum_model;		/* Checksum model seen on the bus when
+				   dlc is not configured (SLLIN_CSUM_*) */
+	bool updated;		/* Changed since the response was last sent */
+};
+
+#define SLLIN_CSUM_UNKNOWN	0
+#define SLLIN_CSUM_CLASSIC	1
+#define SLLIN_CSUM_ENHANCED	2
+
+/* Latency histogram buckets: [0] < 1 us, [n] < 2^n us, last one the rest */
+#define SLLIN_LAT_BUCKETS	20
+
+/*
+ * Statistics of one LIN ID. Updated only with sm_lock held and read
+ * without any lock by ethtool and debugfs.
+ */
+struct sllin_id_stats {
+	u32 headers;		/* Headers sent (Master) or received (Slave) */
+	u32 responses;		/* Valid responses received */
+	u32 csum_errors;
+	u32 timeouts;
+	u32 framing_errors;
+	u32 collisions;		/* Of event triggered frame */
+	u32 lat_first[SLLIN_LAT_BUCKETS]; /* PID to the first response byte */
+	u32 lat_last[SLLIN_LAT_BUCKETS];  /* PID to the last response byte */
 };
 
 struct sllin {
@@ -157,9 +266,15 @@ struct sllin {
 	int			rx_expect;      /* expected number of Rx chars */
 	int			rx_lim;         /* maximum Rx chars for current frame */
 	int			rx_cnt;         /* message buffer Rx fill level  */
+	unsigned		rx_csum_cls;	/* Running sums of rx_buff without */
+	unsigned		rx_csum_enh;	/* the last byte (the checksum)    */
+	int			rx_csum_model;	/* Model of the last validated frame */
+	ktime_t			rx_now;		/* Time of the current receive_buf() */
+	ktime_t			rx_ts[SLLIN_TS_CNT]; /* Phases of the received frame */
 	int			tx_lim;         /* actual limit of bytes to Tx */
 	int			tx_cnt;         /* number of already Tx bytes */
 	char			lin_master;	/* node is a master node */
+	bool			monitor;	/* Listen only (lin_master is 0) */
 	int			lin_baud;	/* LIN baudrate */
 	int			lin_state;	/* state */
 	char			id_to_send;	/* there is ID to be sent */
@@ -173,24 +288,78 @@ struct sllin {
 	unsigned long		flags;		/* Flag values/ mode etc     */
 #define SLF_INUSE		0		/* Channel in use            */
 #define SLF_ERROR		1               /* Parity, etc. error        */
-#define SLF_RXEVENT		2               /* Rx wake event             */
-#define SLF_TXEVENT		3               /* Tx wake event             */
+#define SLF_BREAKRQ		2               /* Break to be sent by worker */
+#define SLF_STOPPING		3               /* Channel is being closed   */
 #define SLF_MSGEVENT		4               /* CAN message to sent       */
-#define SLF_TMOUTEVENT		5               /* Timeout on received data  */
+#define SLF_DIAGEVENT		5               /* Diagnostic frame to be sent */
 #define SLF_TXBUFF_RQ		6               /* Req. to send buffer to UART*/
 #define SLF_TXBUFF_INPR		7               /* Above request in progress */
+#define SLF_SCHEDEVENT		8               /* Header requested by schedule */
+#define SLF_BAUDRQ		9               /* Baudrate change by worker */
 
 	dev_t			line;
-	struct task_struct	*kwthread;
-	wait_queue_head_t	kwt_wq;		/* Wait queue used by kwthread */
+	spinlock_t		sm_lock;	/* Serializes state machine runs */
+	struct sllin_worker	*worker;	/* Worker from the shared pool */
+	int			worker_cpu;	/* Requested CPU or -1 (any) */
+	struct kthread_work	work;		/* Sleeping operations only
+						   (break, error recovery) */
+	int			break_phase;	/* SLLIN_BREAK_*, protected by
+						   sm_lock in BREAK_BY_BAUD */
+#ifndef BREAK_BY_BAUD
+	struct hrtimer		break_timer;	/* Break and delimiter length */
+	ktime_t			break_deadline; /* End of the current phase */
+	ktime_t			break_len;
+	ktime_t			break_delim_len;
+#endif
 	struct hrtimer          rx_timer;       /* RX timeout timer */
-	ktime_t	                rx_timer_timeout; /* RX timeout timer value */
-	struct sk_buff          *tx_req_skb;	/* Socket buffer with CAN frame
-						received from network stack*/
+	ktime_t	                rx_timer_timeout; /* RX timeout of the header */
+	u32			hdr_timeout_us;	/* Set by IFLA_SLLIN_TIMEOUT, 0 when
+						   derived from lin_baud */
+
+	/* Baudrate detection (Slave mode), protected by sm_lock */
+	bool			autobaud;	/* Enabled */
+	bool			autobaud_locked; /* lin_baud matches the bus */
+	bool			autobaud_brk;	/* Break received, sync expected */
+	int			autobaud_fails;	/* Errors since the last change */
+	int			autobaud_idx;	/* Candidate tried last */
+	int			autobaud_rate;	/* Requested from the worker */
+	u32			resp_timeout_us[LIN_ID_MAX + 1]; /* Overrides of
+						   response timeout, 0 if none */
+	bool			rx_timer_armed; /* rx_timer expiry is valid */
+	struct sk_buff_head	tx_queue;	/* CAN frames received from
+						network stack waiting to be
+						processed */
+	struct sk_buff_head	rx_batch;	/* Received frames to be delivered
+						   by sllin_rx_flush() */
+
+	/* Schedule table executor */
+	struct hrtimer		sched_timer;	/* Fires at the start of each slot */
+	spinlock_t		sched_lock;	/* Protects sched_* fields below */
+	struct lin_sched_table	sched_tables[LIN_SCHED_TABLES_MAX];
+	int			sched_active;	/* Running table or LIN_SCHED_TABLE_NONE */
+	int			sched_next;	/* Table to be used from the next slot */
+	int			sched_slot;	/* Index of the next slot in sched_active */
+	struct lin_sched_slot	sched_cur;	/* Slot of the header to be sent */
 
 	/* List with configurations for	each of 0 to LIN_ID_MAX LIN IDs */
 	struct sllin_conf_entry linfr_cache[LIN_ID_MAX + 1];
-	spinlock_t		linfr_lock;	/* frame cache and buffers lock */
+	spinlock_t		linfr_lock;	/* frame cache writers lock */
+
+	/* Diagnostic transport layer (Master mode) */
+	struct mutex		diag_mutex;	/* One transfer at a time */
+	wait_queue_head_t	diag_wq;	/* Waiting for the result */
+	struct hrtimer		diag_timer;	/* Next poll or deadline */
+	struct sllin_diag	diag;
+
+	/* Event triggered frames (Master mode), protected by sm_lock */
+	struct sllin_evt	evt[LIN_ID_MAX + 1];
+	u8			evt_resolve[LIN_EVT_ASSOC_MAX]; /* Headers
+						   resolving the collision */
+	int			evt_resolve_cnt;
+	int			evt_resolve_pos; /* Next one to be sent */
+
+	struct sllin_id_stats	id_stats[LIN_ID_MAX + 1];
+	struct dentry		*debugfs;	/* Per channel statistics file */
 
 #ifdef SLLIN_LED_TRIGGER
 	struct led_trigger *tx_led_trig;
@@ -202,8 +371,49 @@ struct sllin {
 #endif
 };
 
-static struct net_device **sllin_devs;
+/* Pool of worker threads shared by all channels, one per CPU */
+struct sllin_worker {
+	struct kthread_worker	worker;
+	struct task_struct	*task;
+	int			cpu;
+};
+
+/* Channels indexed by dev->base_addr (sllinN), no fixed limit */
+static DEFINE_IDR(sllin_idr);
+static DEFINE_SPINLOCK(sllin_idr_lock);
+
+/* LIN ID of the frame being processed, for tracing */
+static inline int sllin_trace_id(struct sllin *sl)
+{
+	if (sl->lin_master)
+		return sl->tx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
+
+	return (sl->rx_cnt > SLLIN_BUFF_ID) ?
+		(sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK) : -1;
+}
+
+static inline void sllin_set_state(struct sllin *sl, int state)
+{
+	trace_sllin_state(sl->dev, sllin_trace_id(sl), sl->lin_state, state);
+	sl->lin_state = state;
+}
+static struct sllin_worker *sllin_workers;
+static int sllin_workers_cnt;
 static int sllin_configure_frame_cache(struct sllin *sl, struct can_frame *cf);
+static void sllin_sched_stop(struct sllin *sl);
+static void sllin_sched_suspend(struct sllin *sl);
+static void sllin_sched_resume(struct sllin *sl);
+static void sllin_sm_run(struct sllin *sl);
+static void sllin_sm_kick(struct sllin *sl);
+static void sllin_diag_rx(struct sllin *sl, unsigned char *data, int len);
+static void sllin_diag_error(struct sllin *sl, int lin_id);
+static void sllin_diag_abort(struct sllin *sl, int err);
+static bool sllin_evt_collision(struct sllin *sl, int lin_id, int err);
+static void sllin_worker_queue(struct sllin *sl);
+static void sllin_timing_update(struct sllin *sl);
+static ktime_t sllin_gap_timeout(struct sllin *sl);
+static void sllin_rx_timer_start(struct sllin *sl, ktime_t timeout);
+static void sllin_rx_timer_stop(struct sllin *sl);
 static void sllin_slave_receive_buf(struct tty_struct *tty,
 			      const unsigned char *cp, char *fp, int count);
 static void sllin_master_receive_buf(struct tty_struct *tty,
@@ -297,16 +507,13 @@ static void devm_sllin_led_init(struct net_device *netdev)
 
 static struct sllin *netdev_priv_safe(struct net_device *dev)
 {
-	int i;
-
-	if (sllin_devs == NULL)
-		return NULL;
+	struct net_device *found;
 
-	for (i = 0; i < maxdev; ++i)
-		if (sllin_devs[i] == dev)
-			return netdev_priv(dev);
+	spin_lock(&sllin_idr_lock);
+	found = idr_find(&sllin_idr, dev->base_addr);
+	spin_unlock(&sllin_idr_lock);
 
-	return NULL;
+	return (found == dev) ? netdev_priv(dev) : NULL;
 }
 
 static int sllin_netdev_notifier_call(struct notifier_block *nb, unsigned long msg,
@@ -396,37 +603,134 @@ static int sltty_change_speed(struct tty_struct *tty, unsigned speed)
 	return 0;
 }
 
-/* Send one can_frame to the network layer */
-static void sllin_send_canfr(struct sllin *sl, canid_t id, char *data, int len)
+/*
+ * sllin_alloc_can_skb() -- Allocate skb for one CAN frame; the frame
+ *			    is zeroed and filled in place by the caller
+ *
+ * Same as alloc_can_skb() without depending on can-dev module.
+ */
+static struct sk_buff *sllin_alloc_can_skb(struct net_device *dev,
+		struct can_frame **cf)
 {
 	struct sk_buff *skb;
-	struct can_frame cf;
 
-	cf.can_id = id;
-	cf.can_dlc = len;
-	if (cf.can_dlc > 0)
-		memcpy(&cf.data, data, cf.can_dlc);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0)
+	skb = netdev_alloc_skb(dev, sizeof(struct can_skb_priv) +
+			       sizeof(struct can_frame));
+	if (unlikely(!skb))
+		return NULL;
 
-	skb = dev_alloc_skb(sizeof(struct can_frame));
-	if (!skb)
-		return;
+	can_skb_reserve(skb);
+	can_skb_prv(skb)->ifindex = dev->ifindex;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	can_skb_prv(skb)->skbcnt = 0;
+#endif
+#else
+	skb = netdev_alloc_skb(dev, sizeof(struct can_frame));
+	if (unlikely(!skb))
+		return NULL;
+#endif
 
-	skb->dev = sl->dev;
 	skb->protocol = htons(ETH_P_CAN);
 	skb->pkt_type = PACKET_BROADCAST;
 	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	memcpy(skb_put(skb, sizeof(struct can_frame)),
-	       &cf, sizeof(struct can_frame));
-	netif_rx(skb);
+
+	*cf = (struct can_frame *)skb_put(skb, sizeof(struct can_frame));
+	memset(*cf, 0, sizeof(struct can_frame));
+
+	return skb;
+}
+
+/*
+ * sllin_send_canfr() -- Queue CAN frame for the network layer
+ *
+ * Called with sm_lock held. The frames are delivered by sllin_rx_flush()
+ * once the event is processed.
+ *
+ * @ts: SLLIN_TS_* index of the phase of the LIN frame the CAN frame
+ *	is stamped with or SLLIN_TS_NONE. The time of the break is passed
+ *	as hardware timestamp.
+ */
+static void sllin_send_canfr(struct sllin *sl, canid_t id, const u8 *data,
+		int len, int ts)
+{
+	struct sk_buff *skb;
+	struct can_frame *cf;
+
+	skb = sllin_alloc_can_skb(sl->dev, &cf);
+	if (!skb) {
+		sl->dev->stats.rx_dropped++;
+		return;
+	}
+
+	cf->can_id = id;
+	cf->can_dlc = len;
+	if (cf->can_dlc > 0)
+		memcpy(cf->data, data, cf->can_dlc);
+
+	/*
+	 * Bus times taken in receive_buf instead of the time of netif_rx().
+	 * rx_ts[] is monotonic, the socket layer expects CLOCK_REALTIME.
+	 */
+	if ((ts != SLLIN_TS_NONE) && ktime_to_ns(sl->rx_ts[ts])) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0)
+		skb->tstamp = ktime_mono_to_real(sl->rx_ts[ts]);
+#else
+		skb->tstamp = ktime_add(sl->rx_ts[ts],
+			ktime_sub(ktime_get_real(), ktime_get()));
+#endif
+		skb_hwtstamps(skb)->hwtstamp = sl->rx_ts[SLLIN_TS_BREAK];
+	}
+	__skb_queue_tail(&sl->rx_batch, skb);
 
 	sl->dev->stats.rx_packets++;
-	sl->dev->stats.rx_bytes += cf.can_dlc;
+	sl->dev->stats.rx_bytes += len;
 
 #ifdef SLLIN_LED_TRIGGER
 	sllin_led_event(sl->dev, SLLIN_LED_EVENT_RX);
 #endif
 }
 
+/**
+ * __sllin_rx_flush() -- Deliver frames queued by sllin_send_canfr()
+ *
+ * Called after sm_lock is released. With @direct the frames are passed
+ * to netif_receive_skb() one after another with BH disabled once,
+ * without going through the backlog and NET_RX softirq. Otherwise they
+ * are queued by netif_rx().
+ */
+static void __sllin_rx_flush(struct sllin *sl, bool direct)
+{
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	if (skb_queue_empty(&sl->rx_batch))
+		return;
+
+	__skb_queue_head_init(&batch);
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	skb_queue_splice_tail_init(&sl->rx_batch, &batch);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	if (!direct) {
+		while ((skb = __skb_dequeue(&batch)) != NULL)
+			netif_rx(skb);
+		return;
+	}
+
+	local_bh_disable();
+	while ((skb = __skb_dequeue(&batch)) != NULL)
+		netif_receive_skb(skb);
+	local_bh_enable();
+}
+
+/* Direct delivery from process context, netif_rx() from the timers */
+static void sllin_rx_flush(struct sllin *sl)
+{
+	__sllin_rx_flush(sl, !in_irq() && !irqs_disabled());
+}
+
 /**
  * sll_bump() -- Send data of received LIN frame (existing in sl->rx_buff)
  *		 as CAN frame
@@ -436,16 +740,25 @@ static void sllin_send_canfr(struct sllin *sl, canid_t id, char *data, int len)
 static void sll_bump(struct sllin *sl)
 {
 	int len = sl->rx_cnt - SLLIN_BUFF_DATA - 1; /* without checksum */
+	canid_t id = sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
 	len = (len < 0) ? 0 : len;
 
-	sllin_send_canfr(sl, sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK,
-		sl->rx_buff + SLLIN_BUFF_DATA, len);
+	/* Monitor reports the checksum model seen on the bus */
+	if (sl->monitor && (sl->rx_csum_model == SLLIN_CSUM_ENHANCED))
+		id |= LIN_CHECKSUM_EXTENDED;
+
+	if (sl->lin_master &&
+		((sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK) == LIN_DIAG_SLAVE_RESP_ID))
+		sllin_diag_rx(sl, sl->rx_buff + SLLIN_BUFF_DATA, len);
+
+	sllin_send_canfr(sl, id, sl->rx_buff + SLLIN_BUFF_DATA, len,
+		SLLIN_TS_DATA_LAST);
 }
 
 static void sll_send_rtr(struct sllin *sl)
 {
 	sllin_send_canfr(sl, (sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK) |
-		CAN_RTR_FLAG, NULL, 0);
+		CAN_RTR_FLAG, NULL, 0, SLLIN_TS_PID);
 }
 
 /*
@@ -475,14 +788,20 @@ static void sllin_write_wakeup(struct tty_struct *tty)
 		smp_mb__after_atomic();
 #endif
 
+#ifdef BREAK_BY_BAUD
 		if (sl->lin_state != SLSTATE_BREAK_SENT)
 			remains = sl->tx_lim - sl->tx_cnt;
 		else
 			remains = SLLIN_BUFF_BREAK + 1 - sl->tx_cnt;
+#else
+		remains = sl->tx_lim - sl->tx_cnt;
+#endif
 
 		if (remains > 0) {
 			actual = tty->ops->write(tty, sl->tx_buff + sl->tx_cnt,
-				sl->tx_cnt - sl->tx_lim);
+				remains);
+			trace_sllin_tx(sl->dev, sllin_trace_id(sl), sl->tx_cnt,
+				actual, remains - actual);
 			sl->tx_cnt += actual;
 			remains -= actual;
 		}
@@ -501,11 +820,50 @@ static void sllin_write_wakeup(struct tty_struct *tty)
 		return;
 	}
 
+	/* State machine is driven by the echo of transmitted bytes
+	   received in sllin_receive_buf(), nothing to do here */
 	clear_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
-	set_bit(SLF_TXEVENT, &sl->flags);
-	wake_up(&sl->kwt_wq);
 
-	netdev_dbg(sl->dev, "sllin_write_wakeup sent %d, wakeup\n", sl->tx_cnt);
+	netdev_dbg(sl->dev, "sllin_write_wakeup sent %d, done\n", sl->tx_cnt);
+}
+
+/**
+ * sllin_tx_queue_next() -- Dequeue the oldest CAN frame received from
+ *			    the network stack
+ *
+ * @sl:
+ *
+ * Wakes the netdev queue when there is room in tx_queue again.
+ * SLF_MSGEVENT is kept set as long as there are frames pending.
+ */
+static struct sk_buff *sllin_tx_queue_next(struct sllin *sl)
+{
+	struct sk_buff *skb;
+
+	skb = skb_dequeue(&sl->tx_queue);
+	if (skb_queue_empty(&sl->tx_queue)) {
+		clear_bit(SLF_MSGEVENT, &sl->flags);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 18, 0)
+		smp_mb__after_clear_bit();
+#else
+		smp_mb__after_atomic();
+#endif
+		/* Frame enqueued concurrently with the clear_bit() above */
+		if (!skb_queue_empty(&sl->tx_queue))
+			set_bit(SLF_MSGEVENT, &sl->flags);
+	}
+
+	if (netif_queue_stopped(sl->dev) &&
+		(skb_queue_len(&sl->tx_queue) < SLLIN_TX_QUEUE_LEN))
+		netif_wake_queue(sl->dev);
+
+	return skb;
+}
+
+static void sllin_tx_queue_purge(struct sllin *sl)
+{
+	skb_queue_purge(&sl->tx_queue);
+	clear_bit(SLF_MSGEVENT, &sl->flags);
 }
 
 /**
@@ -518,6 +876,7 @@ static netdev_tx_t sll_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct sllin *sl = netdev_priv(dev);
 	struct can_frame *cf;
+	unsigned long flags;
 
 	if (skb->len != sizeof(struct can_frame))
 		goto err_out;
@@ -527,7 +886,7 @@ static netdev_tx_t sll_xmit(struct sk_buff *skb, struct net_device *dev)
 		netdev_warn(sl->dev, "xmit: iface is down\n");
 		goto err_out_unlock;
 	}
-	if (sl->tty == NULL) {
+	if ((sl->tty == NULL) || test_bit(SLF_STOPPING, &sl->flags)) {
 		netdev_warn(sl->dev, "xmit: no tty device connected\n");
 		goto err_out_unlock;
 	}
@@ -538,12 +897,27 @@ static netdev_tx_t sll_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto free_out_unlock;
 	}
 
-	netif_stop_queue(sl->dev);
+	/* Monitor never transmits */
+	if (sl->monitor) {
+		sl->dev->stats.tx_dropped++;
+		goto free_out_unlock;
+	}
+
+	skb_queue_tail(&sl->tx_queue, skb);
+	if (skb_queue_len(&sl->tx_queue) >= SLLIN_TX_QUEUE_LEN)
+		netif_stop_queue(sl->dev);
 
-	sl->tx_req_skb = skb;
 	set_bit(SLF_MSGEVENT, &sl->flags);
-	wake_up(&sl->kwt_wq);
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sllin_sm_run(sl);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
 	spin_unlock(&sl->lock);
+
+	/*
+	 * The TX lock of this device is still held, protocol handlers
+	 * (e.g. can-gw) must not run from here
+	 */
+	__sllin_rx_flush(sl, false);
 	return NETDEV_TX_OK;
 
 free_out_unlock:
@@ -563,6 +937,7 @@ err_out:
 static int sll_close(struct net_device *dev)
 {
 	struct sllin *sl = netdev_priv(dev);
+	unsigned long flags;
 
 	spin_lock_bh(&sl->lock);
 	if (sl->tty) {
@@ -573,6 +948,14 @@ static int sll_close(struct net_device *dev)
 	sl->rx_expect = 0;
 	sl->tx_lim    = 0;
 	spin_unlock_bh(&sl->lock);
+	sllin_sched_suspend(sl);
+	sllin_diag_abort(sl, -ENETDOWN);
+	sllin_tx_queue_purge(sl);
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sl->evt_resolve_cnt = 0;
+	sl->evt_resolve_pos = 0;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
 
 #ifdef SLLIN_LED_TRIGGER
 	sllin_led_event(dev, SLLIN_LED_EVENT_STOP);
@@ -592,6 +975,7 @@ static int sll_open(struct net_device *dev)
 
 	sl->flags &= (1 << SLF_INUSE);
 	netif_start_queue(dev);
+	sllin_sched_resume(sl);
 
 #ifdef SLLIN_LED_TRIGGER
 	sllin_led_event(dev, SLLIN_LED_EVENT_OPEN);
@@ -603,8 +987,13 @@ static int sll_open(struct net_device *dev)
 static void sll_free_netdev(struct net_device *dev)
 {
 	int i = dev->base_addr;
+
+	/* Unpublish first, notifiers look the device up by idr_find() */
+	spin_lock(&sllin_idr_lock);
+	idr_remove(&sllin_idr, i);
+	spin_unlock(&sllin_idr_lock);
+
 	free_netdev(dev);
-	sllin_devs[i] = NULL;
 }
 
 static const struct net_device_ops sll_netdev_ops = {
@@ -613,9 +1002,155 @@ static const struct net_device_ops sll_netdev_ops = {
 	.ndo_start_xmit         = sll_xmit,
 };
 
+/************************************
+ *  Per-ID statistics
+ ************************************/
+static struct dentry *sllin_debugfs_dir;
+
+/* Short enough for "idNN_" prefix within ETH_GSTRING_LEN */
+static const char * const sllin_id_stats_names[] = {
+	"headers", "responses", "csum_errors", "timeouts", "framing_errors",
+	"collisions",
+};
+
+#define SLLIN_ID_STATS_CNT	ARRAY_SIZE(sllin_id_stats_names)
+
+static inline unsigned sllin_lat_bucket(s64 us)
+{
+	unsigned b;
+
+	if (us <= 0)
+		return 0;
+
+	b = fls(us > 0x7fffffff ? 0x7fffffff : (unsigned)us);
+	return (b < SLLIN_LAT_BUCKETS) ? b : SLLIN_LAT_BUCKETS - 1;
+}
+
+/* Valid response of the frame in rx_buff received, called with sm_lock held */
+static void sllin_stats_response(struct sllin *sl)
+{
+	struct sllin_id_stats *st =
+		&sl->id_stats[sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK];
+
+	st->responses++;
+
+	if (!ktime_to_ns(sl->rx_ts[SLLIN_TS_PID]) ||
+		!ktime_to_ns(sl->rx_ts[SLLIN_TS_DATA_FIRST]))
+		return;
+
+	st->lat_first[sllin_lat_bucket(ktime_us_delta(
+		sl->rx_ts[SLLIN_TS_DATA_FIRST], sl->rx_ts[SLLIN_TS_PID]))]++;
+	st->lat_last[sllin_lat_bucket(ktime_us_delta(
+		sl->rx_ts[SLLIN_TS_DATA_LAST], sl->rx_ts[SLLIN_TS_PID]))]++;
+}
+
+static int sll_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return (LIN_ID_MAX + 1) * SLLIN_ID_STATS_CNT;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void sll_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	char *p = (char *)data;
+	int id, i;
+
+	if (sset != ETH_SS_STATS)
+		return;
+
+	for (id = 0; id <= LIN_ID_MAX; id++) {
+		for (i = 0; i < SLLIN_ID_STATS_CNT; i++) {
+			scnprintf(p, ETH_GSTRING_LEN, "id%02d_%s", id,
+				sllin_id_stats_names[i]);
+			p += ETH_GSTRING_LEN;
+		}
+	}
+}
+
+static void sll_get_ethtool_stats(struct net_device *dev,
+		struct ethtool_stats *stats, u64 *data)
+{
+	struct sllin *sl = netdev_priv(dev);
+	struct sllin_id_stats *st;
+	int id;
+
+	for (id = 0; id <= LIN_ID_MAX; id++) {
+		st = &sl->id_stats[id];
+		*data++ = ACCESS_ONCE(st->headers);
+		*data++ = ACCESS_ONCE(st->responses);
+		*data++ = ACCESS_ONCE(st->csum_errors);
+		*data++ = ACCESS_ONCE(st->timeouts);
+		*data++ = ACCESS_ONCE(st->framing_errors);
+		*data++ = ACCESS_ONCE(st->collisions);
+	}
+}
+
+static const struct ethtool_ops sll_ethtool_ops = {
+	.get_strings		= sll_get_strings,
+	.get_sset_count		= sll_get_sset_count,
+	.get_ethtool_stats	= sll_get_ethtool_stats,
+};
+
+static void sllin_debugfs_hist(struct seq_file *m, const char *name, u32 *hist)
+{
+	int i;
+
+	seq_printf(m, "  %s:", name);
+	for (i = 0; i < SLLIN_LAT_BUCKETS; i++)
+		seq_printf(m, " %u", ACCESS_ONCE(hist[i]));
+	seq_putc(m, '\n');
+}
+
+static int sllin_debugfs_show(struct seq_file *m, void *v)
+{
+	struct sllin *sl = m->private;
+	struct sllin_id_stats *st;
+	int id;
+
+	seq_printf(m, "# latency buckets: <1us");
+	for (id = 1; id < SLLIN_LAT_BUCKETS - 1; id++)
+		seq_printf(m, " <%luus", 1ul << id);
+	seq_printf(m, " >=%luus\n", 1ul << (SLLIN_LAT_BUCKETS - 2));
+
+	for (id = 0; id <= LIN_ID_MAX; id++) {
+		st = &sl->id_stats[id];
+		if (!ACCESS_ONCE(st->headers) && !ACCESS_ONCE(st->responses))
+			continue;
+
+		seq_printf(m, "id %2d: headers %u responses %u csum_errors %u "
+			"timeouts %u framing_errors %u collisions %u\n", id,
+			ACCESS_ONCE(st->headers), ACCESS_ONCE(st->responses),
+			ACCESS_ONCE(st->csum_errors), ACCESS_ONCE(st->timeouts),
+			ACCESS_ONCE(st->framing_errors),
+			ACCESS_ONCE(st->collisions));
+		sllin_debugfs_hist(m, "lat_first", st->lat_first);
+		sllin_debugfs_hist(m, "lat_last", st->lat_last);
+	}
+
+	return 0;
+}
+
+static int sllin_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sllin_debugfs_show, inode->i_private);
+}
+
+static const struct file_operations sllin_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sllin_debugfs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static void sll_setup(struct net_device *dev)
 {
 	dev->netdev_ops		= &sll_netdev_ops;
+	dev->ethtool_ops	= &sll_ethtool_ops;
 	dev->destructor		= sll_free_netdev;
 
 	dev->hard_header_len	= 0;
@@ -633,13 +1168,88 @@ static void sll_setup(struct net_device *dev)
 /******************************************
   Routines looking at TTY side.
  ******************************************/
+
+/* Add one byte to the LIN checksum (sum with carry) */
+static inline unsigned sllin_csum_add(unsigned csum, unsigned char c)
+{
+	csum += c;
+	if (csum > 255)
+		csum -= 255;
+
+	return csum;
+}
+
+/*
+ * sllin_rx_put() -- Store received character to rx_buff
+ *
+ * Both classic and enhanced checksums are accumulated as the characters
+ * arrive. The sums do not include the last received character, which is
+ * the checksum when the frame is complete. Time of the character is
+ * recorded for the phases of the frame (rx_ts[]).
+ */
+static inline void sllin_rx_put(struct sllin *sl, unsigned char c)
+{
+	int i = sl->rx_cnt;
+
+	if (i == SLLIN_BUFF_BREAK) {
+		sl->rx_ts[SLLIN_TS_BREAK] = sl->rx_now;
+		sl->rx_ts[SLLIN_TS_PID] = ktime_set(0, 0);
+		sl->rx_ts[SLLIN_TS_DATA_FIRST] = ktime_set(0, 0);
+		sl->rx_ts[SLLIN_TS_DATA_LAST] = ktime_set(0, 0);
+	} else if (i == SLLIN_BUFF_ID) {
+		sl->rx_ts[SLLIN_TS_PID] = sl->rx_now;
+	} else if (i == SLLIN_BUFF_DATA) {
+		sl->rx_ts[SLLIN_TS_DATA_FIRST] = sl->rx_now;
+	}
+	if (i >= SLLIN_BUFF_DATA)
+		sl->rx_ts[SLLIN_TS_DATA_LAST] = sl->rx_now;
+
+	if (i == SLLIN_BUFF_ID) {
+		sl->rx_csum_cls = 0;
+		sl->rx_csum_enh = 0;
+	} else if (i > SLLIN_BUFF_ID) {
+		sl->rx_csum_enh = sllin_csum_add(sl->rx_csum_enh,
+			sl->rx_buff[i - 1]);
+		if (i > SLLIN_BUFF_DATA)
+			sl->rx_csum_cls = sllin_csum_add(sl->rx_csum_cls,
+				sl->rx_buff[i - 1]);
+	}
+
+	sl->rx_buff[sl->rx_cnt++] = c;
+}
+
+/*
+ * Master waits for a slave response whose length is neither in the
+ * frame cache nor in the RTR frame, called with sm_lock held
+ */
+static bool sllin_master_resp_len_unknown(struct sllin *sl)
+{
+	return !sl->resp_len_known && !sl->data_to_send &&
+		((sl->lin_state == SLSTATE_RESPONSE_WAIT) ||
+		(sl->lin_state == SLSTATE_RESPONSE_WAIT_BUS));
+}
+
 static void sllin_master_receive_buf(struct tty_struct *tty,
 			      const unsigned char *cp, char *fp, int count)
 {
 	struct sllin *sl = (struct sllin *) tty->disc_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sl->rx_now = ktime_get();
+
+	/* Bus is not idle yet after an error, see sllin_work() */
+	if (test_bit(SLF_ERROR, &sl->flags)) {
+		if (sl->rx_timer_armed)
+			sllin_rx_timer_start(sl, sllin_gap_timeout(sl));
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+		return;
+	}
 
 	/* Read the characters out of the buffer */
 	while (count--) {
+		trace_sllin_rx(sl->dev, sllin_trace_id(sl), sl->rx_cnt, *cp,
+			fp ? *fp : 0);
 		if (fp && *fp++) {
 			netdev_dbg(sl->dev, "sllin_master_receive_buf char 0x%02x ignored "
 				"due marker 0x%02x, flags 0x%lx\n",
@@ -648,7 +1258,9 @@ static void sllin_master_receive_buf(struct tty_struct *tty,
 			/* i.e. Real error -- not Break */
 			if (sl->rx_cnt > SLLIN_BUFF_BREAK) {
 				set_bit(SLF_ERROR, &sl->flags);
-				wake_up(&sl->kwt_wq);
+				sllin_rx_timer_stop(sl);
+				sllin_worker_queue(sl);
+				spin_unlock_irqrestore(&sl->sm_lock, flags);
 				return;
 			}
 		}
@@ -657,30 +1269,119 @@ static void sllin_master_receive_buf(struct tty_struct *tty,
 		/* We didn't receive Break character -- fake it! */
 		if ((sl->rx_cnt == SLLIN_BUFF_BREAK) && (*cp == 0x55)) {
 			netdev_dbg(sl->dev, "LIN_RX[%d]: 0x00\n", sl->rx_cnt);
-			sl->rx_buff[sl->rx_cnt++] = 0x00;
+			sllin_rx_put(sl, 0x00);
 		}
 #endif /* BREAK_BY_BAUD */
 
 		if (sl->rx_cnt < SLLIN_BUFF_LEN) {
 			netdev_dbg(sl->dev, "LIN_RX[%d]: 0x%02x\n", sl->rx_cnt, *cp);
-			sl->rx_buff[sl->rx_cnt++] = *cp++;
+			sllin_rx_put(sl, *cp++);
 		}
 	}
 
 
 	if (sl->rx_cnt >= sl->rx_expect) {
-		set_bit(SLF_RXEVENT, &sl->flags);
-		wake_up(&sl->kwt_wq);
-		netdev_dbg(sl->dev, "sllin_receive_buf count %d, wakeup\n", sl->rx_cnt);
+		netdev_dbg(sl->dev, "sllin_receive_buf count %d, processing\n", sl->rx_cnt);
+#ifdef BREAK_BY_BAUD
+		/* Echo of the break character, the worker restores the rate */
+		if (sl->break_phase == SLLIN_BREAK_ASSERTED)
+			sllin_worker_queue(sl);
+#endif
+		sllin_sm_run(sl);
 	} else {
 		netdev_dbg(sl->dev, "sllin_receive_buf count %d, waiting\n", sl->rx_cnt);
 	}
+
+	/* Response of unknown length ends by inter-byte gap */
+	if (sllin_master_resp_len_unknown(sl) && (sl->rx_cnt > SLLIN_BUFF_DATA))
+		sllin_rx_timer_start(sl, sllin_gap_timeout(sl));
+
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
 }
 
 
 /*****************************************
  *  sllin message helper routines
  *****************************************/
+
+/**
+ * sllin_resp_timeout() -- Response timeout of given LIN ID
+ *
+ * @sl:
+ * @lin_id:
+ * @dlc:    Expected length of the response, 0 when unknown
+ *
+ * T_response_max = 1.4 * T_response_nominal = 1.4 * 10 * (N + 1) bit
+ * times for N data bytes (SLLIN_DATA_MAX when unknown), plus the receive
+ * latency of the UART. Userspace can override it for each ID.
+ */
+static ktime_t sllin_resp_timeout(struct sllin *sl, int lin_id, int dlc)
+{
+	u32 us = sl->resp_timeout_us[lin_id];
+	unsigned bits;
+
+	if (us)
+		return ns_to_ktime((u64)us * NSEC_PER_USEC);
+
+	if ((dlc <= 0) || (dlc > SLLIN_DATA_MAX))
+		dlc = SLLIN_DATA_MAX;
+
+	bits = 14 * (dlc + 1) + SLLIN_SAMPLES_PER_CHAR * SLLIN_RX_LATENCY_CHARS;
+	return ns_to_ktime(div_u64((u64)NSEC_PER_SEC * bits, sl->lin_baud));
+}
+
+/*
+ * Inter-byte gap ending the response of unknown length -- 1.5 character
+ * times plus the receive latency of the UART
+ */
+static ktime_t sllin_gap_timeout(struct sllin *sl)
+{
+	return ns_to_ktime(div_u64((u64)NSEC_PER_SEC * (15 +
+		SLLIN_SAMPLES_PER_CHAR * SLLIN_RX_LATENCY_CHARS), sl->lin_baud));
+}
+
+static int sllin_set_resp_timeout(struct sllin *sl,
+		struct lin_resp_timeout __user *uto)
+{
+	struct lin_resp_timeout to;
+	unsigned long flags;
+
+	if (copy_from_user(&to, uto, sizeof(to)))
+		return -EFAULT;
+
+	if (to.lin_id > LIN_ID_MAX)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sl->resp_timeout_us[to.lin_id] = to.timeout_us;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	return 0;
+}
+
+/* Both called with sm_lock held */
+static void sllin_rx_timer_start(struct sllin *sl, ktime_t timeout)
+{
+	ktime_t expires = ktime_add(ktime_get(), timeout);
+
+	trace_sllin_timer(sl->dev, sllin_trace_id(sl), SLLIN_TRACE_TIMER_RX,
+		SLLIN_TRACE_TIMER_START, ktime_to_ns(expires));
+	sl->rx_timer_armed = true;
+	hrtimer_start(&sl->rx_timer, expires, HRTIMER_MODE_ABS);
+}
+
+/*
+ * The timer handler takes sm_lock so we cannot wait for it here.
+ * When it is already running, it finds rx_timer_armed cleared.
+ */
+static void sllin_rx_timer_stop(struct sllin *sl)
+{
+	if (sl->rx_timer_armed)
+		trace_sllin_timer(sl->dev, sllin_trace_id(sl),
+			SLLIN_TRACE_TIMER_RX, SLLIN_TRACE_TIMER_CANCEL, 0);
+	sl->rx_timer_armed = false;
+	hrtimer_try_to_cancel(&sl->rx_timer);
+}
 /**
  * sllin_report_error() -- Report an error by sending CAN frame
  *	with particular error flag set in can_id
@@ -693,30 +1394,81 @@ static void sllin_report_error(struct sllin *sl, int err)
 	unsigned char *lin_buff;
 	int lin_id;
 
+	lin_buff = (sl->lin_master) ? sl->tx_buff : sl->rx_buff;
+	lin_id = lin_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
+	trace_sllin_error(sl->dev, lin_id, err);
+	sllin_diag_error(sl, lin_id);
+	if (sllin_evt_collision(sl, lin_id, err))
+		return;
+
 	switch (err) {
 	case LIN_ERR_CHECKSUM:
 		sl->dev->stats.rx_crc_errors++;
+		sl->id_stats[lin_id].csum_errors++;
 		break;
 
 	case LIN_ERR_RX_TIMEOUT:
 		sl->dev->stats.rx_errors++;
+		sl->id_stats[lin_id].timeouts++;
 		break;
 
 	case LIN_ERR_FRAMING:
 		sl->dev->stats.rx_frame_errors++;
+		sl->id_stats[lin_id].framing_errors++;
 		break;
 	}
-
-	lin_buff = (sl->lin_master) ? sl->tx_buff : sl->rx_buff;
-	lin_id = lin_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
 	sllin_send_canfr(sl, lin_id | CAN_EFF_FLAG |
-		(err & ~LIN_ID_MASK), NULL, 0);
+		(err & ~LIN_ID_MASK), NULL, 0, SLLIN_TS_NONE);
 }
 
 /**
- * sllin_configure_frame_cache() -- Configure particular entry in linfr_cache
+ * sllin_checksum() -- Count checksum for particular data
  *
- * @sl:
+ * @data:	 Pointer to the buffer containing whole LIN
+ *		 frame (i.e. including break and sync bytes).
+ * @length:	 Length of the buffer.
+ * @enhanced_fl: Flag determining whether Enhanced or Classic
+ *		 checksum should be counted.
+ */
+static inline unsigned sllin_checksum(unsigned char *data, int length, int enhanced_fl)
+{
+	unsigned csum = 0;
+	int i;
+
+	if (enhanced_fl)
+		i = SLLIN_BUFF_ID;
+	else
+		i = SLLIN_BUFF_DATA;
+
+	for (; i < length; i++)
+		csum = sllin_csum_add(csum, data[i]);
+
+	return ~csum & 0xff;
+}
+
+/*
+ * Pre-encode the response (data and checksum) of linfr_cache entry,
+ * called within write section of the entry
+ */
+static void sllin_cache_encode(struct sllin_conf_entry *sce, int lin_id)
+{
+	unsigned char frame[SLLIN_BUFF_LEN];
+	int dlc = sce->dlc;
+
+	if (dlc > SLLIN_DATA_MAX)
+		dlc = SLLIN_DATA_MAX;
+
+	frame[SLLIN_BUFF_ID] = lin_id | sllin_id_parity_table[lin_id];
+	memcpy(frame + SLLIN_BUFF_DATA, sce->data, dlc);
+	memcpy(sce->resp, sce->data, dlc);
+	sce->resp[dlc] = sllin_checksum(frame, SLLIN_BUFF_DATA + dlc,
+		sce->frame_fl & LIN_CHECKSUM_EXTENDED);
+}
+
+/**
+ * sllin_configure_frame_cache() -- Configure particular entry in linfr_cache
+ *
+ * @sl:
  * @cf: Pointer to CAN frame sent to this driver
  *	holding configuration information
  */
@@ -733,45 +1485,168 @@ static int sllin_configure_frame_cache(struct sllin *sl, struct can_frame *cf)
 		cf->can_id & LIN_ID_MASK);
 
 	spin_lock_irqsave(&sl->linfr_lock, flags);
+	write_seqcount_begin(&sce->seq);
 
 	sce->dlc = cf->can_dlc;
 	if (sce->dlc > SLLIN_DATA_MAX)
 		sce->dlc = SLLIN_DATA_MAX;
 
 	sce->frame_fl = (cf->can_id & ~LIN_ID_MASK) & CAN_EFF_MASK;
-	memcpy(sce->data, cf->data, cf->can_dlc);
+	memcpy(sce->data, cf->data, sce->dlc);
+	sce->csum_model = SLLIN_CSUM_UNKNOWN;
+	sce->updated = true;
+	sllin_cache_encode(sce, cf->can_id & LIN_ID_MASK);
 
+	write_seqcount_end(&sce->seq);
 	spin_unlock_irqrestore(&sl->linfr_lock, flags);
 
 	return 0;
 }
 
 /**
- * sllin_checksum() -- Count checksum for particular data
+ * sllin_cache_read() -- Get consistent copy of linfr_cache entry
  *
- * @data:	 Pointer to the buffer containing whole LIN
- *		 frame (i.e. including break and sync bytes).
- * @length:	 Length of the buffer.
- * @enhanced_fl: Flag determining whether Enhanced or Classic
- *		 checksum should be counted.
+ * Lockless, retried when a writer updated the entry meanwhile.
+ *
+ * @sl:
+ * @lin_id: LIN ID of the entry
+ * @copy:   Where to store the copy (seq is not touched)
  */
-static inline unsigned sllin_checksum(unsigned char *data, int length, int enhanced_fl)
+static void sllin_cache_read(struct sllin *sl, int lin_id,
+		struct sllin_conf_entry *copy)
 {
-	unsigned csum = 0;
+	struct sllin_conf_entry *sce = &sl->linfr_cache[lin_id];
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&sce->seq);
+		copy->dlc = sce->dlc;
+		copy->frame_fl = sce->frame_fl;
+		memcpy(copy->data, sce->data, sizeof(copy->data));
+		memcpy(copy->resp, sce->resp, sizeof(copy->resp));
+		copy->csum_model = sce->csum_model;
+		copy->updated = sce->updated;
+	} while (read_seqcount_retry(&sce->seq, seq));
+}
+
+/*
+ * Response from linfr_cache was sent -- clear its updated flag and
+ * disable it when marked with LIN_SINGLE_RESPONSE
+ */
+static void sllin_cache_response_sent(struct sllin *sl, int lin_id)
+{
+	struct sllin_conf_entry *sce = &sl->linfr_cache[lin_id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&sl->linfr_lock, flags);
+	write_seqcount_begin(&sce->seq);
+	sce->updated = false;
+	if (sce->frame_fl & LIN_SINGLE_RESPONSE)
+		sce->frame_fl &= ~LIN_CACHE_RESPONSE;
+	write_seqcount_end(&sce->seq);
+	spin_unlock_irqrestore(&sl->linfr_lock, flags);
+}
+
+/**
+ * sllin_cache_load() -- Replace the whole linfr_cache from userspace
+ *
+ * @sl:
+ * @ucache: Pointer to struct lin_cache in userspace
+ *
+ * All entries are written under sm_lock, so no LIN frame is processed
+ * with partially updated cache.
+ */
+static int sllin_cache_load(struct sllin *sl, struct lin_cache __user *ucache)
+{
+	struct lin_cache *cache;
+	struct lin_cache_entry *lce;
+	struct sllin_conf_entry *sce;
+	unsigned long flags;
+	canid_t frame_fl;
+	int ret = 0;
 	int i;
 
-	if (enhanced_fl)
-		i = SLLIN_BUFF_ID;
-	else
-		i = SLLIN_BUFF_DATA;
+	cache = kmalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
 
-	for (; i < length; i++) {
-		csum += data[i];
-		if (csum > 255)
-			csum -= 255;
+	if (copy_from_user(cache, ucache, sizeof(*cache))) {
+		ret = -EFAULT;
+		goto out;
 	}
 
-	return ~csum & 0xff;
+	for (i = 0; i <= LIN_ID_MAX; i++) {
+		if (cache->entry[i].dlc > SLLIN_DATA_MAX) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	spin_lock(&sl->linfr_lock);
+	for (i = 0; i <= LIN_ID_MAX; i++) {
+		lce = &cache->entry[i];
+		sce = &sl->linfr_cache[i];
+
+		frame_fl = (lce->frame_fl & ~LIN_ID_MASK) & CAN_EFF_MASK;
+
+		write_seqcount_begin(&sce->seq);
+		/* Only changed entries are sent in sporadic slots */
+		if ((sce->dlc != lce->dlc) || (sce->frame_fl != frame_fl) ||
+			memcmp(sce->data, lce->data, lce->dlc))
+			sce->updated = true;
+		sce->dlc = lce->dlc;
+		sce->frame_fl = frame_fl;
+		memcpy(sce->data, lce->data, sizeof(sce->data));
+		sce->csum_model = SLLIN_CSUM_UNKNOWN;
+		sllin_cache_encode(sce, i);
+		write_seqcount_end(&sce->seq);
+	}
+	spin_unlock(&sl->linfr_lock);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	netdev_dbg(sl->dev, "Frame cache loaded\n");
+out:
+	kfree(cache);
+	return ret;
+}
+
+/**
+ * sllin_cache_dump() -- Copy the whole linfr_cache to userspace
+ *
+ * @sl:
+ * @ucache: Pointer to struct lin_cache in userspace
+ */
+static int sllin_cache_dump(struct sllin *sl, struct lin_cache __user *ucache)
+{
+	struct lin_cache *cache;
+	struct lin_cache_entry *lce;
+	struct sllin_conf_entry *sce;
+	unsigned long flags;
+	int ret = 0;
+	int i;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+
+	/* All writers hold linfr_lock */
+	spin_lock_irqsave(&sl->linfr_lock, flags);
+	for (i = 0; i <= LIN_ID_MAX; i++) {
+		lce = &cache->entry[i];
+		sce = &sl->linfr_cache[i];
+
+		lce->dlc = sce->dlc;
+		lce->frame_fl = sce->frame_fl;
+		memcpy(lce->data, sce->data, sizeof(lce->data));
+	}
+	spin_unlock_irqrestore(&sl->linfr_lock, flags);
+
+	if (copy_to_user(ucache, cache, sizeof(*cache)))
+		ret = -EFAULT;
+
+	kfree(cache);
+	return ret;
 }
 
 #define SLLIN_STPMSG_RESPONLY		(1) /* Message will be LIN Response only */
@@ -809,6 +1684,19 @@ static int sllin_setup_msg(struct sllin *sl, int mode, int id,
 	return 0;
 }
 
+/*
+ * sllin_setup_response() -- Prepare tx_buff with response pre-encoded
+ *			     by sllin_cache_encode() (Slave mode)
+ */
+static void sllin_setup_response(struct sllin *sl, int id,
+		unsigned char *resp, int len)
+{
+	sl->tx_buff[SLLIN_BUFF_ID] = id | sllin_id_parity_table[id];
+	memcpy(sl->tx_buff + SLLIN_BUFF_DATA, resp, len + 1);
+	sl->tx_lim = SLLIN_BUFF_DATA + len + 1;
+	sl->rx_lim = sl->tx_lim;
+}
+
 static void sllin_reset_buffs(struct sllin *sl)
 {
 	sl->rx_cnt = 0;
@@ -823,6 +1711,11 @@ static void sllin_reset_buffs(struct sllin *sl)
 /**
  * sllin_rx_validate() -- Validate received frame, i,e. check checksum
  *
+ * Checksums were accumulated by sllin_rx_put(), so only the received
+ * checksum is compared here. When the length of the frame is not
+ * configured, both models are tried and the matching one is remembered
+ * in linfr_cache to be the only one checked next time.
+ *
  * @sl:
  */
 static int sllin_rx_validate(struct sllin *sl)
@@ -830,33 +1723,64 @@ static int sllin_rx_validate(struct sllin *sl)
 	unsigned long flags;
 	int actual_id;
 	int ext_chcks_fl;
-	int lin_dlc;
+	int model;
+	int res = 0;
 	unsigned char rec_chcksm = sl->rx_buff[sl->rx_cnt - 1];
-	struct sllin_conf_entry *sce;
+	unsigned char csum_cls = ~sl->rx_csum_cls & 0xff;
+	unsigned char csum_enh = ~sl->rx_csum_enh & 0xff;
+	struct sllin_conf_entry sce;
+
+	if (sl->rx_cnt <= SLLIN_BUFF_DATA)
+		return -1;
 
 	actual_id = sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
-	sce = &sl->linfr_cache[actual_id];
+	sllin_cache_read(sl, actual_id, &sce);
+	ext_chcks_fl = sce.frame_fl & LIN_CHECKSUM_EXTENDED;
 
-	spin_lock_irqsave(&sl->linfr_lock, flags);
-	lin_dlc = sce->dlc;
-	ext_chcks_fl = sce->frame_fl & LIN_CHECKSUM_EXTENDED;
-	spin_unlock_irqrestore(&sl->linfr_lock, flags);
+	/* Type of checksum is configured for particular frame */
+	if (sce.dlc > 0) {
+		model = ext_chcks_fl ? SLLIN_CSUM_ENHANCED : SLLIN_CSUM_CLASSIC;
+	} else {
+		model = sce.csum_model;
+		if (model == SLLIN_CSUM_UNKNOWN) {
+			if (rec_chcksm == (ext_chcks_fl ? csum_enh : csum_cls))
+				model = ext_chcks_fl ? SLLIN_CSUM_ENHANCED :
+					SLLIN_CSUM_CLASSIC;
+			else
+				model = ext_chcks_fl ? SLLIN_CSUM_CLASSIC :
+					SLLIN_CSUM_ENHANCED;
+		}
+	}
 
-	if (sllin_checksum(sl->rx_buff, sl->rx_cnt - 1, ext_chcks_fl) !=
-		rec_chcksm) {
+	if (rec_chcksm != ((model == SLLIN_CSUM_ENHANCED) ? csum_enh : csum_cls))
+		res = -1;
 
-		/* Type of checksum is configured for particular frame */
-		if (lin_dlc > 0) {
-			return -1;
-		} else {
-			if (sllin_checksum(sl->rx_buff,	sl->rx_cnt - 1,
-				!ext_chcks_fl) != rec_chcksm) {
-				return -1;
-			}
+	/* Monitor accepts whichever model the frame uses */
+	if (res && sl->monitor) {
+		model = (model == SLLIN_CSUM_ENHANCED) ? SLLIN_CSUM_CLASSIC :
+			SLLIN_CSUM_ENHANCED;
+		if (rec_chcksm == ((model == SLLIN_CSUM_ENHANCED) ?
+			csum_enh : csum_cls))
+			res = 0;
+	}
+
+	/* Learn the model or forget it when it does not match any more */
+	if (res)
+		model = SLLIN_CSUM_UNKNOWN;
+	sl->rx_csum_model = model;
+	if ((sce.dlc <= 0) && (sce.csum_model != model)) {
+		struct sllin_conf_entry *entry = &sl->linfr_cache[actual_id];
+
+		spin_lock_irqsave(&sl->linfr_lock, flags);
+		if (entry->dlc <= 0) {
+			write_seqcount_begin(&entry->seq);
+			entry->csum_model = model;
+			write_seqcount_end(&entry->seq);
 		}
+		spin_unlock_irqrestore(&sl->linfr_lock, flags);
 	}
 
-	return 0;
+	return res;
 }
 
 static void sllin_slave_finish_rx_msg(struct sllin *sl)
@@ -867,6 +1791,7 @@ static void sllin_slave_finish_rx_msg(struct sllin *sl)
 	} else {
 		/* Send CAN non-RTR frame with data */
 		netdev_dbg(sl->dev, "sllin: sending NON-RTR CAN frame with LIN payload.");
+		sllin_stats_response(sl);
 		sll_bump(sl); /* send packet to the network layer */
 	}
 	/* Prepare for reception of new header */
@@ -876,17 +1801,175 @@ static void sllin_slave_finish_rx_msg(struct sllin *sl)
 	sl->header_received = false;
 }
 
+/*****************************************
+ *  Baudrate detection (Slave mode)
+ *****************************************/
+
+static const int sllin_autobaud_rates[] = {
+	19200, 10417, 9600, 4800, 2400, 1200,
+};
+
+#define SLLIN_AUTOBAUD_TRIES	2	/* Wrong sync fields before next rate */
+#define SLLIN_AUTOBAUD_ERRORS	16	/* UART errors without any break */
+#define SLLIN_AUTOBAUD_RELOCK	8	/* Errors to lose the lock */
+
+/*
+ * sllin_autobaud_predict() -- Character received by the UART running at
+ *			       @uart_baud when sync field (0x55) is sent
+ *			       at @bus_baud
+ *
+ * The reception starts by the falling edge of the start bit and data
+ * bits are sampled in the middle of UART bit times. Even bits of the
+ * sync field frame (start bit and 0 data bits) are dominant. Returns -1
+ * when a sample falls behind the stop bit (the PID might follow).
+ */
+static int sllin_autobaud_predict(int uart_baud, int bus_baud)
+{
+	int c = 0;
+	int bit;
+	int i;
+
+	for (i = 1; i <= 8; i++) {
+		bit = ((2 * i + 1) * bus_baud) / (2 * uart_baud);
+		if (bit >= 10)
+			return -1;
+		if (bit & 1)
+			c |= 1 << (i - 1);
+	}
+
+	return c;
+}
+
+/*
+ * Request the worker to reprogram the UART, to the next candidate
+ * when @rate is 0. Called with sm_lock held.
+ */
+static void sllin_autobaud_set(struct sllin *sl, int rate)
+{
+	int i;
+
+	if (rate) {
+		for (i = 0; i < ARRAY_SIZE(sllin_autobaud_rates); i++) {
+			if (sllin_autobaud_rates[i] == rate)
+				sl->autobaud_idx = i;
+		}
+	} else {
+		sl->autobaud_idx = (sl->autobaud_idx + 1) %
+			ARRAY_SIZE(sllin_autobaud_rates);
+		rate = sllin_autobaud_rates[sl->autobaud_idx];
+	}
+
+	netdev_dbg(sl->dev, "autobaud: trying %d\n", rate);
+	sl->autobaud_rate = rate;
+	sl->autobaud_fails = 0;
+	sl->autobaud_brk = false;
+	set_bit(SLF_BAUDRQ, &sl->flags);
+	sllin_worker_queue(sl);
+}
+
+/* Sync field after the break does not match the rate guessed so far */
+static void sllin_autobaud_sync_error(struct sllin *sl, unsigned char c)
+{
+	int rate;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sllin_autobaud_rates); i++) {
+		rate = sllin_autobaud_rates[i];
+		if ((rate != sl->lin_baud) &&
+			(sllin_autobaud_predict(sl->lin_baud, rate) == c)) {
+			sllin_autobaud_set(sl, rate);
+			return;
+		}
+	}
+
+	if (++sl->autobaud_fails >= SLLIN_AUTOBAUD_TRIES)
+		sllin_autobaud_set(sl, 0);
+}
+
+/*
+ * sllin_autobaud_rx() -- Process received character while the rate is
+ *			  not locked yet
+ *
+ * Called with sm_lock held. When break followed by a valid sync field
+ * is found, the rate is locked and rx_buff is prepared for the PID.
+ */
+static void sllin_autobaud_rx(struct sllin *sl, unsigned char c, char flag)
+{
+	/* Characters received at the previous rate */
+	if (test_bit(SLF_BAUDRQ, &sl->flags))
+		return;
+
+	/* Break (possibly split into more characters) */
+	if ((c == 0x00) && (flag || sl->autobaud_brk)) {
+		sl->autobaud_brk = true;
+		return;
+	}
+
+	if (!sl->autobaud_brk) {
+		if (flag && (++sl->autobaud_fails >= SLLIN_AUTOBAUD_ERRORS))
+			sllin_autobaud_set(sl, 0);
+		return;
+	}
+
+	sl->autobaud_brk = false;
+	if ((c != 0x55) || flag) {
+		sllin_autobaud_sync_error(sl, c);
+		return;
+	}
+
+	netdev_info(sl->dev, "autobaud: locked at %d\n", sl->lin_baud);
+	sl->autobaud_locked = true;
+	sl->autobaud_fails = 0;
+
+	sl->rx_cnt = 0;
+	sl->rx_expect = SLLIN_BUFF_ID + 1;
+	sl->rx_len_unknown = false;
+	sl->header_received = false;
+	sllin_rx_put(sl, 0x00);
+	sllin_rx_put(sl, 0x55);
+}
+
+/* Error while the rate is locked, called with sm_lock held */
+static void sllin_autobaud_error(struct sllin *sl)
+{
+	if (!sl->autobaud || !sl->autobaud_locked)
+		return;
+
+	if (++sl->autobaud_fails >= SLLIN_AUTOBAUD_RELOCK) {
+		netdev_info(sl->dev, "autobaud: lock lost\n");
+		sl->autobaud_locked = false;
+		sl->autobaud_fails = 0;
+		sl->autobaud_brk = false;
+	}
+}
+
 static void sllin_slave_receive_buf(struct tty_struct *tty,
 			      const unsigned char *cp, char *fp, int count)
 {
 	struct sllin *sl = (struct sllin *) tty->disc_data;
 	int lin_id;
-	struct sllin_conf_entry *sce;
+	struct sllin_conf_entry sce;
+	unsigned long flags;
 
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sl->rx_now = ktime_get();
 
 	/* Read the characters out of the buffer */
 	while (count--) {
+		trace_sllin_rx(sl->dev, sllin_trace_id(sl), sl->rx_cnt, *cp,
+			fp ? *fp : 0);
+
+		/* Looking for the rate, nothing is received meanwhile */
+		if (sl->autobaud && !sl->autobaud_locked) {
+			sllin_autobaud_rx(sl, *cp++, fp ? *fp++ : 0);
+			continue;
+		}
+
 		if (fp && *fp++) {
+			/* Framing or parity error, not a break */
+			if (*cp != 0x00)
+				sllin_autobaud_error(sl);
+
 			/*
 			 * If we don't know the length of the current message
 			 * and received at least the LIN ID, we received here
@@ -896,11 +1979,9 @@ static void sllin_slave_receive_buf(struct tty_struct *tty,
 			if ((sl->rx_len_unknown == true) &&
 				(sl->rx_cnt >= SLLIN_BUFF_ID))
 			{
-				hrtimer_cancel(&sl->rx_timer);
+				sllin_rx_timer_stop(sl);
 				sllin_slave_finish_rx_msg(sl);
-
-				set_bit(SLF_RXEVENT, &sl->flags);
-				wake_up(&sl->kwt_wq);
+				sllin_sm_run(sl);
 			}
 
 			netdev_dbg(sl->dev, "sllin_slave_receive_buf char 0x%02x ignored "
@@ -919,7 +2000,7 @@ static void sllin_slave_receive_buf(struct tty_struct *tty,
 
 			/* We did not receive break (0x00) character */
 			if ((sl->rx_cnt == SLLIN_BUFF_BREAK) && (*cp == 0x55)) {
-				sl->rx_buff[sl->rx_cnt++] = 0x00;
+				sllin_rx_put(sl, 0x00);
 			}
 
 			if (sl->rx_cnt == SLLIN_BUFF_SYNC) {
@@ -930,39 +2011,47 @@ static void sllin_slave_receive_buf(struct tty_struct *tty,
 				}
 
 				/* Wrong sync character */
-				if (*cp != 0x55)
+				if (*cp != 0x55) {
+					sllin_autobaud_error(sl);
 					break;
+				}
+				sl->autobaud_fails = 0;
 			}
 
-			sl->rx_buff[sl->rx_cnt++] = *cp++;
+			sllin_rx_put(sl, *cp++);
 		}
 
 		/* Header received */
 		if ((sl->header_received == false) && (sl->rx_cnt >= (SLLIN_BUFF_ID + 1))) {
-			unsigned long flags;
+			bool resp_len_known;
 
 			lin_id = sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
-			sce = &sl->linfr_cache[lin_id];
+			sllin_cache_read(sl, lin_id, &sce);
+			sl->id_stats[lin_id].headers++;
 
-			spin_lock_irqsave(&sl->linfr_lock, flags);
-
-			sl->lin_state = SLSTATE_ID_RECEIVED;
+			sllin_set_state(sl, SLSTATE_ID_RECEIVED);
 			/* Is the length of data set in frame cache? */
-			if (sce->dlc > 0) {
-				sl->rx_expect += sce->dlc + 1; /* + checksum */
+			if (sce.dlc > 0) {
+				sl->rx_expect += sce.dlc + 1; /* + checksum */
 				sl->rx_len_unknown = false;
-				wake_up(&sl->kwt_wq);
 			} else {
 				sl->rx_expect += SLLIN_DATA_MAX + 1; /* + checksum */
 				sl->rx_len_unknown = true;
 			}
-			spin_unlock_irqrestore(&sl->linfr_lock, flags);
+			resp_len_known = !sl->rx_len_unknown;
 
 			sl->header_received = true;
 
-			hrtimer_start(&sl->rx_timer,
-				ktime_add(ktime_get(), sl->rx_timer_timeout),
-				HRTIMER_MODE_ABS);
+			sllin_rx_timer_start(sl,
+				sllin_resp_timeout(sl, lin_id, sce.dlc));
+
+			/* Monitor reports the whole frame only */
+			if (sl->monitor)
+				continue;
+
+			/* Send the response from frame cache right away */
+			if (resp_len_known)
+				sllin_sm_run(sl);
 			sll_send_rtr(sl);
 			continue;
 		}
@@ -971,34 +2060,62 @@ static void sllin_slave_receive_buf(struct tty_struct *tty,
 		if ((sl->header_received == true) &&
 			((sl->rx_cnt >= sl->rx_expect))) {
 
-			hrtimer_cancel(&sl->rx_timer);
+			sllin_rx_timer_stop(sl);
 			netdev_dbg(sl->dev, "Received LIN header & LIN response. "
 					"rx_cnt = %u, rx_expect = %u\n", sl->rx_cnt,
 					sl->rx_expect);
 			sllin_slave_finish_rx_msg(sl);
-
-			set_bit(SLF_RXEVENT, &sl->flags);
-			wake_up(&sl->kwt_wq);
+			sllin_sm_run(sl);
 		}
 	}
+
+	/* Response of unknown length ends by inter-byte gap */
+	if (sl->header_received && sl->rx_len_unknown &&
+		(sl->lin_state != SLSTATE_RESPONSE_SENT) &&
+		(sl->rx_cnt > SLLIN_BUFF_DATA))
+		sllin_rx_timer_start(sl, sllin_gap_timeout(sl));
+
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
 }
 
-static void sllin_receive_buf(struct tty_struct *tty,
+/*
+ * The characters are processed as soon as the TTY layer passes them,
+ * they are worthless once delayed by flow control. Everything is
+ * consumed; characters beyond the frame are dropped by the state
+ * machine and those received while the interface is down are dropped
+ * here, otherwise they would stall the flip buffer.
+ */
+static int sllin_receive_buf2(struct tty_struct *tty,
 			      const unsigned char *cp, char *fp, int count)
 {
 	struct sllin *sl = (struct sllin *) tty->disc_data;
+
+	if (!sl || sl->magic != SLLIN_MAGIC)
+		return count;
+
 	netdev_dbg(sl->dev, "sllin_receive_buf invoked, count = %u\n", count);
 
-	if (!sl || sl->magic != SLLIN_MAGIC || !netif_running(sl->dev))
-		return;
+	if (!netif_running(sl->dev))
+		return count;
 
 	if (sl->lin_master)
 		sllin_master_receive_buf(tty, cp, fp, count);
 	else
 		sllin_slave_receive_buf(tty, cp, fp, count);
 
+	sllin_rx_flush(sl);
+
+	return count;
 }
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 12, 0)
+static void sllin_receive_buf(struct tty_struct *tty,
+			      const unsigned char *cp, char *fp, int count)
+{
+	sllin_receive_buf2(tty, cp, fp, count);
+}
+#endif
+
 static int sllin_send_tx_buff(struct sllin *sl)
 {
 	struct tty_struct *tty = sl->tty;
@@ -1029,6 +2146,8 @@ static int sllin_send_tx_buff(struct sllin *sl)
 		res = tty->ops->write(tty, sl->tx_buff + sl->tx_cnt, remains);
 		if (res < 0)
 			goto error_in_write;
+		trace_sllin_tx(sl->dev, sllin_trace_id(sl), sl->tx_cnt, res,
+			remains - res);
 
 		remains -= res;
 		sl->tx_cnt += res;
@@ -1040,6 +2159,8 @@ static int sllin_send_tx_buff(struct sllin *sl)
 				clear_bit(TTY_DO_WRITE_WAKEUP, &tty->flags);
 				goto error_in_write;
 			}
+			trace_sllin_tx(sl->dev, sllin_trace_id(sl), sl->tx_cnt,
+				res, remains - res);
 
 			remains -= res;
 			sl->tx_cnt += res;
@@ -1069,183 +2190,1096 @@ error_in_write:
 
 }
 
+/* Break generation finished, called with sm_lock held */
+static void sllin_break_finish(struct sllin *sl)
+{
+	clear_bit(SLF_BREAKRQ, &sl->flags);
+	sllin_sm_run(sl);
+}
+
+/*
+ * sllin_send_break() -- Generate LIN break on the bus
+ *
+ * Called from the worker (might sleep) while the state machine waits
+ * in SLSTATE_BREAK_SENT with SLF_BREAKRQ set. sllin_break_finish()
+ * is called once the break is over.
+ */
 #ifdef BREAK_BY_BAUD
+/*
+ * The break is a 0x00 character sent at 2/3 of lin_baud:
+ * lower the rate and send it (worker) -> its echo is received (or
+ * rx_timer expires) -> restore the rate (worker).
+ * The worker does not sleep waiting for the echo, it serves other
+ * channels meanwhile.
+ */
 static int sllin_send_break(struct sllin *sl)
 {
 	struct tty_struct *tty = sl->tty;
-	unsigned long break_baud;
+	unsigned long flags;
+	bool echoed;
 	int res;
 
-	break_baud = ((sl->lin_baud * 2) / 3);
-	sltty_change_speed(tty, break_baud);
+	switch (sl->break_phase) {
+	case SLLIN_BREAK_NONE:
+		sltty_change_speed(tty, (sl->lin_baud * 2) / 3);
+
+		tty->ops->flush_buffer(tty);
+
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		sl->break_phase = SLLIN_BREAK_ASSERTED;
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+		res = sllin_send_tx_buff(sl);
+		if (res < 0)
+			return res;
+		break;
+
+	case SLLIN_BREAK_ASSERTED:
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		echoed = (sl->lin_state != SLSTATE_BREAK_SENT) ||
+			(sl->rx_cnt > SLLIN_BUFF_BREAK);
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+		/* Queued for another reason than the echo */
+		if (!echoed)
+			break;
+
+		res = sltty_change_speed(tty, sl->lin_baud);
 
-	tty->ops->flush_buffer(tty);
-	sl->rx_cnt = SLLIN_BUFF_BREAK;
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		sl->break_phase = SLLIN_BREAK_NONE;
+		if (res >= 0)
+			sllin_break_finish(sl);
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
 
-	sl->rx_expect = SLLIN_BUFF_BREAK + 1;
-	sl->lin_state = SLSTATE_BREAK_SENT;
+		if (res < 0)
+			return res;
+		break;
 
-	res = sllin_send_tx_buff(sl);
-	if (res < 0) {
-		sl->lin_state = SLSTATE_IDLE;
-		return res;
+	default:
+		break;
 	}
 
 	return 0;
 }
+
+/* Called from the worker or on close */
+static void sllin_break_abort(struct sllin *sl)
+{
+	unsigned long flags;
+	int phase;
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	phase = sl->break_phase;
+	sl->break_phase = SLLIN_BREAK_NONE;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	if (phase != SLLIN_BREAK_NONE)
+		sltty_change_speed(sl->tty, sl->lin_baud);
+}
 #else /* BREAK_BY_BAUD */
 
+/*
+ * The break is a sequence driven by break_timer:
+ * assert (worker) -> break_len -> deassert (worker) -> break_delim_len
+ * -> sync + PID sent directly from the timer handler.
+ * The worker does not sleep in between.
+ *
+ * break_ctl() might sleep (uart_break_ctl() takes the port mutex), so
+ * the break cannot be deasserted from the timer handler. break_len is
+ * the minimum, the break is longer by the wakeup latency of the worker
+ * and the duration of break_ctl(). The delimiter is measured from the
+ * actual deassertion. BREAK_BY_BAUD times the break by the UART.
+ */
 static int sllin_send_break(struct sllin *sl)
 {
 	struct tty_struct *tty = sl->tty;
 	int retval;
-	unsigned long break_baud;
-	unsigned long usleep_range_min;
-	unsigned long usleep_range_max;
-
-	break_baud = ((sl->lin_baud * 2) / 3);
-	sl->rx_cnt = SLLIN_BUFF_BREAK;
-	sl->rx_expect = SLLIN_BUFF_BREAK + 1;
-	sl->lin_state = SLSTATE_BREAK_SENT;
-
-	/* Do the break ourselves; Inspired by
-	   http://lxr.linux.no/#linux+v3.1.2/drivers/tty/tty_io.c#L2452 */
-	retval = tty->ops->break_ctl(tty, -1);
-	if (retval)
-		return retval;
 
-	/* udelay(712); */
-	usleep_range_min = (1000000l * SLLIN_SAMPLES_PER_CHAR) / break_baud;
-	usleep_range_max = usleep_range_min + 50;
-	usleep_range(usleep_range_min, usleep_range_max);
-
-	retval = tty->ops->break_ctl(tty, 0);
-	usleep_range_min = (1000000l * 1 /* 1 bit */) / break_baud;
-	usleep_range_max = usleep_range_min + 30;
-	usleep_range(usleep_range_min, usleep_range_max);
+	switch (sl->break_phase) {
+	case SLLIN_BREAK_NONE:
+		/* Do the break ourselves; Inspired by
+		   http://lxr.linux.no/#linux+v3.1.2/drivers/tty/tty_io.c#L2452 */
+		retval = tty->ops->break_ctl(tty, -1);
+		if (retval)
+			return retval;
+
+		sl->break_phase = SLLIN_BREAK_ASSERTED;
+		sl->break_deadline = ktime_add(ktime_get(), sl->break_len);
+		trace_sllin_timer(sl->dev, sllin_trace_id(sl),
+			SLLIN_TRACE_TIMER_BREAK, SLLIN_TRACE_TIMER_START,
+			ktime_to_ns(sl->break_deadline));
+		hrtimer_start(&sl->break_timer, sl->break_deadline,
+			HRTIMER_MODE_ABS);
+		break;
 
-	tty->ops->flush_buffer(tty);
+	case SLLIN_BREAK_ASSERTED:
+		/* Woken up for another reason than break_timer */
+		if (ktime_compare(ktime_get(), sl->break_deadline) < 0)
+			break;
 
-	sl->tx_cnt = SLLIN_BUFF_SYNC;
+		retval = tty->ops->break_ctl(tty, 0);
+		sl->break_phase = SLLIN_BREAK_DELIMITER;
+		sl->break_deadline = ktime_add(ktime_get(), sl->break_delim_len);
+		trace_sllin_timer(sl->dev, sllin_trace_id(sl),
+			SLLIN_TRACE_TIMER_BREAK, SLLIN_TRACE_TIMER_START,
+			ktime_to_ns(sl->break_deadline));
+		hrtimer_start(&sl->break_timer, sl->break_deadline,
+			HRTIMER_MODE_ABS);
+		if (retval)
+			return retval;
+		break;
 
-	netdev_dbg(sl->dev, "Break sent.\n");
-	set_bit(SLF_RXEVENT, &sl->flags);
-	wake_up(&sl->kwt_wq);
+	case SLLIN_BREAK_DELIMITER:
+		/* Finished by sllin_break_timer_handler() */
+		break;
+	}
 
 	return 0;
 }
-#endif /* BREAK_BY_BAUD */
-
 
-static enum hrtimer_restart sllin_rx_timeout_handler(struct hrtimer *hrtimer)
+static enum hrtimer_restart sllin_break_timer_handler(struct hrtimer *hrtimer)
 {
-	struct sllin *sl = container_of(hrtimer, struct sllin, rx_timer);
+	struct sllin *sl = container_of(hrtimer, struct sllin, break_timer);
+	struct tty_struct *tty = sl->tty;
+	unsigned long flags;
 
-	/*
-	 * Signal timeout when:
-	 * master: We did not receive as much characters as expected
-	 * slave: * we did not receive any data bytes at all
+	trace_sllin_timer(sl->dev, sllin_trace_id(sl), SLLIN_TRACE_TIMER_BREAK,
+		SLLIN_TRACE_TIMER_EXPIRE, ktime_to_ns(hrtimer_get_expires(hrtimer)));
+
+	switch (sl->break_phase) {
+	case SLLIN_BREAK_ASSERTED:
+		/* break_ctl() might sleep */
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		sllin_worker_queue(sl);
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+		break;
+
+	case SLLIN_BREAK_DELIMITER:
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		sl->break_phase = SLLIN_BREAK_NONE;
+		if (test_bit(SLF_BREAKRQ, &sl->flags)) {
+			tty->ops->flush_buffer(tty);
+			sl->tx_cnt = SLLIN_BUFF_SYNC;
+			netdev_dbg(sl->dev, "Break sent.\n");
+			sllin_break_finish(sl);
+		}
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+		sllin_rx_flush(sl);
+		break;
+
+	case SLLIN_BREAK_NONE:
+		break;
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+/* Called from the worker or on close, not from the timer handler */
+static void sllin_break_abort(struct sllin *sl)
+{
+	if (sl->break_phase != SLLIN_BREAK_NONE)
+		trace_sllin_timer(sl->dev, sllin_trace_id(sl),
+			SLLIN_TRACE_TIMER_BREAK, SLLIN_TRACE_TIMER_CANCEL, 0);
+	hrtimer_cancel(&sl->break_timer);
+	if (sl->break_phase == SLLIN_BREAK_ASSERTED)
+		sl->tty->ops->break_ctl(sl->tty, 0);
+	sl->break_phase = SLLIN_BREAK_NONE;
+}
+#endif /* BREAK_BY_BAUD */
+
+
+static enum hrtimer_restart sllin_rx_timeout_handler(struct hrtimer *hrtimer)
+{
+	struct sllin *sl = container_of(hrtimer, struct sllin, rx_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+
+	/* Stopped or restarted while we were waiting for sm_lock */
+	if (!sl->rx_timer_armed ||
+		(ktime_compare(hrtimer_get_expires(hrtimer), ktime_get()) > 0)) {
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	sl->rx_timer_armed = false;
+	trace_sllin_timer(sl->dev, sllin_trace_id(sl), SLLIN_TRACE_TIMER_RX,
+		SLLIN_TRACE_TIMER_EXPIRE, ktime_to_ns(hrtimer_get_expires(hrtimer)));
+
+	/* Bus is idle after an error, see sllin_work() */
+	if (test_bit(SLF_ERROR, &sl->flags)) {
+		netdev_dbg(sl->dev, "Bus idle, error recovery finished\n");
+		clear_bit(SLF_ERROR, &sl->flags);
+		sllin_sm_run(sl);
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+		sllin_rx_flush(sl);
+		return HRTIMER_NORESTART;
+	}
+
+	/*
+	 * Signal timeout when:
+	 * master: We did not receive as much characters as expected
+	 *         and the length is known
+	 * slave: * we did not receive any data bytes at all
 	 *        * we know the length and didn't receive enough
+	 * Otherwise the inter-byte gap ended the response.
 	 */
-	if ((sl->lin_master) ||
+	if (sl->lin_master && sllin_master_resp_len_unknown(sl) &&
+			(sl->rx_cnt > SLLIN_BUFF_DATA)) {
+		sl->rx_expect = sl->rx_cnt;
+		sllin_set_state(sl, SLSTATE_RESPONSE_WAIT_BUS);
+	} else if ((sl->lin_master) ||
 			(sl->rx_cnt <= SLLIN_BUFF_DATA) ||
 			((!sl->rx_len_unknown) &&
 			(sl->rx_cnt < sl->rx_expect))) {
 		sllin_report_error(sl, LIN_ERR_RX_TIMEOUT);
-		set_bit(SLF_TMOUTEVENT, &sl->flags);
+		netdev_dbg(sl->dev, "RX timeout\n");
+		sllin_reset_buffs(sl);
+		sllin_set_state(sl, SLSTATE_IDLE);
 	} else {
 		sllin_slave_finish_rx_msg(sl);
-		set_bit(SLF_RXEVENT, &sl->flags);
 	}
-	wake_up(&sl->kwt_wq);
+#ifdef BREAK_BY_BAUD
+	/* Break character was lost, the worker restores the rate */
+	if (sl->break_phase == SLLIN_BREAK_ASSERTED)
+		sllin_worker_queue(sl);
+#endif
+	sllin_sm_run(sl);
+
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+	sllin_rx_flush(sl);
 
 	return HRTIMER_NORESTART;
 }
 
 /*****************************************
- *  sllin_kwthread - kernel worker thread
+ *  Schedule table executor
  *****************************************/
 
-static int sllin_kwthread(void *ptr)
+/*
+ * Runs at the start of every slot of the active schedule table.
+ * Deadlines are absolute (start of the previous slot + its delay), so
+ * the jitter of the timer interrupt does not accumulate over the table.
+ */
+static enum hrtimer_restart sllin_sched_timer_handler(struct hrtimer *hrtimer)
 {
-	struct sllin *sl = (struct sllin *)ptr;
-	struct tty_struct *tty = sl->tty;
-	struct sched_param schparam = { .sched_priority = 40 };
-	int tx_bytes = 0; /* Used for Network statistics */
+	struct sllin *sl = container_of(hrtimer, struct sllin, sched_timer);
+	struct lin_sched_table *tbl;
+	struct lin_sched_slot *slot;
 	unsigned long flags;
-	int mode;
-	int lin_id;
-	struct sllin_conf_entry *sce;
+	ktime_t next;
+	ktime_t now;
 
-	netdev_dbg(sl->dev, "sllin_kwthread started.\n");
-	sched_setscheduler(current, SCHED_FIFO, &schparam);
+	spin_lock_irqsave(&sl->sched_lock, flags);
 
-	clear_bit(SLF_ERROR, &sl->flags);
-	sltty_change_speed(tty, sl->lin_baud);
+	/* Raced with sll_close(), the table is resumed by sll_open() */
+	if (!netif_running(sl->dev)) {
+		sl->sched_active = LIN_SCHED_TABLE_NONE;
+		spin_unlock_irqrestore(&sl->sched_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	/* Slot boundary -- the only place where the table is switched */
+	if (sl->sched_next != sl->sched_active) {
+		sl->sched_active = sl->sched_next;
+		sl->sched_slot = 0;
+	}
 
-	while (!kthread_should_stop()) {
-		struct can_frame *cf;
-		u8 *lin_data;
-		int lin_dlc;
-		u8 lin_data_buff[SLLIN_DATA_MAX];
+	if (sl->sched_active == LIN_SCHED_TABLE_NONE) {
+		spin_unlock_irqrestore(&sl->sched_lock, flags);
+		return HRTIMER_NORESTART;
+	}
 
+	tbl = &sl->sched_tables[sl->sched_active];
+	if (sl->sched_slot >= tbl->slots_cnt)
+		sl->sched_slot = 0;
 
-		if ((sl->lin_state == SLSTATE_IDLE) && sl->lin_master &&
-			sl->id_to_send) {
-			if (sllin_send_break(sl) < 0) {
-				/* error processing */
-			}
+	slot = &tbl->slot[sl->sched_slot];
+	if (++sl->sched_slot >= tbl->slots_cnt)
+		sl->sched_slot = 0;
+
+	/* Header of the previous slot was not sent yet -- it is lost */
+	if (test_bit(SLF_SCHEDEVENT, &sl->flags))
+		sl->dev->stats.tx_dropped++;
+
+	sl->sched_cur = *slot;
+	set_bit(SLF_SCHEDEVENT, &sl->flags);
+	trace_sllin_timer(sl->dev, slot->lin_id, SLLIN_TRACE_TIMER_SCHED,
+		SLLIN_TRACE_TIMER_EXPIRE, ktime_to_ns(hrtimer_get_expires(hrtimer)));
+
+	now = ktime_get();
+	next = ktime_add_us(hrtimer_get_expires(hrtimer), slot->delay_us);
+	/* Overrun (e.g. timer was delayed over the whole slot) -- do not
+	   try to catch up by sending headers back-to-back */
+	if (ktime_compare(next, now) < 0)
+		next = now;
+	hrtimer_set_expires(hrtimer, next);
+
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+
+	sllin_sm_kick(sl);
+
+	return HRTIMER_RESTART;
+}
+
+static bool sllin_sched_sporadic_valid(struct lin_sched_slot *slot)
+{
+	int i;
+
+	if ((slot->sporadic_cnt == 0) ||
+		(slot->sporadic_cnt > LIN_SCHED_SPORADIC_MAX))
+		return false;
+
+	for (i = 0; i < slot->sporadic_cnt; i++) {
+		if (slot->sporadic[i] > LIN_ID_MAX)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * sllin_sched_slot_id() -- LIN ID of the header to be sent in the slot
+ *
+ * @sl:
+ * @slot: Copy of the slot
+ *
+ * Sporadic slot sends the first candidate with response in the frame
+ * cache updated since it was last sent. Returns -1 when there is none,
+ * i.e. the slot stays empty.
+ */
+static int sllin_sched_slot_id(struct sllin *sl, struct lin_sched_slot *slot)
+{
+	struct sllin_conf_entry sce;
+	int i;
+
+	if (!(slot->flags & LIN_SCHED_SLOT_SPORADIC))
+		return slot->lin_id;
+
+	for (i = 0; i < slot->sporadic_cnt; i++) {
+		sllin_cache_read(sl, slot->sporadic[i], &sce);
+		if (sce.updated && (sce.frame_fl & LIN_CACHE_RESPONSE) &&
+			(sce.dlc > 0))
+			return slot->sporadic[i];
+	}
+
+	return -1;
+}
+
+/**
+ * sllin_sched_set_table() -- Load one schedule table from userspace
+ *
+ * @sl:
+ * @utbl: Pointer to struct lin_sched_table in userspace
+ *
+ * The table may be the active one. It is replaced as a whole under
+ * sched_lock, so the executor never sees it half-updated.
+ */
+static int sllin_sched_set_table(struct sllin *sl,
+		struct lin_sched_table __user *utbl)
+{
+	struct lin_sched_table *tbl;
+	unsigned long flags;
+	int ret = 0;
+	int i;
+
+	tbl = kmalloc(sizeof(*tbl), GFP_KERNEL);
+	if (!tbl)
+		return -ENOMEM;
+
+	if (copy_from_user(tbl, utbl, sizeof(*tbl))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if ((tbl->table >= LIN_SCHED_TABLES_MAX) || (tbl->slots_cnt == 0) ||
+		(tbl->slots_cnt > LIN_SCHED_SLOTS_MAX)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < tbl->slots_cnt; i++) {
+		if ((tbl->slot[i].lin_id > LIN_ID_MAX) ||
+			(tbl->slot[i].delay_us == 0) ||
+			(tbl->slot[i].flags & ~LIN_SCHED_SLOT_SPORADIC)) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if ((tbl->slot[i].flags & LIN_SCHED_SLOT_SPORADIC) &&
+			!sllin_sched_sporadic_valid(&tbl->slot[i])) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	memcpy(&sl->sched_tables[tbl->table], tbl, sizeof(*tbl));
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+
+	netdev_dbg(sl->dev, "Schedule table %u loaded, %u slots\n",
+		tbl->table, tbl->slots_cnt);
+out:
+	kfree(tbl);
+	return ret;
+}
+
+/* Start the executor with sched_next if stopped, called with sched_lock held */
+static void sllin_sched_start_locked(struct sllin *sl)
+{
+	if ((sl->sched_next != LIN_SCHED_TABLE_NONE) &&
+		(sl->sched_active == LIN_SCHED_TABLE_NONE) &&
+		!hrtimer_is_queued(&sl->sched_timer)) {
+		trace_sllin_timer(sl->dev, -1, SLLIN_TRACE_TIMER_SCHED,
+			SLLIN_TRACE_TIMER_START, 0);
+		hrtimer_start(&sl->sched_timer, ktime_get(), HRTIMER_MODE_ABS);
+	}
+}
+
+/**
+ * sllin_sched_switch() -- Request switch of the schedule table
+ *
+ * @sl:
+ * @table: Index of the table or LIN_SCHED_TABLE_NONE to stop the schedule
+ *
+ * The running table is replaced at the next slot boundary. When the
+ * executor is stopped, the first slot of @table starts immediately.
+ * A table can be started only when the interface is up.
+ */
+static int sllin_sched_switch(struct sllin *sl, int table)
+{
+	unsigned long flags;
+
+	if (!sl->lin_master)
+		return -EINVAL;
+
+	if ((table != LIN_SCHED_TABLE_NONE) &&
+		((table < 0) || (table >= LIN_SCHED_TABLES_MAX)))
+		return -EINVAL;
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	if ((table != LIN_SCHED_TABLE_NONE) &&
+		(sl->sched_tables[table].slots_cnt == 0)) {
+		spin_unlock_irqrestore(&sl->sched_lock, flags);
+		return -ENOENT;
+	}
+
+	if ((table != LIN_SCHED_TABLE_NONE) && !netif_running(sl->dev)) {
+		spin_unlock_irqrestore(&sl->sched_lock, flags);
+		return -ENETDOWN;
+	}
+
+	sl->sched_next = table;
+	sllin_sched_start_locked(sl);
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+
+	return 0;
+}
+
+/*
+ * Interface going down -- the executor is stopped, the selected table
+ * stays pending in sched_next and is resumed by sllin_sched_resume()
+ */
+static void sllin_sched_suspend(struct sllin *sl)
+{
+	unsigned long flags;
+
+	trace_sllin_timer(sl->dev, -1, SLLIN_TRACE_TIMER_SCHED,
+		SLLIN_TRACE_TIMER_CANCEL, 0);
+	hrtimer_cancel(&sl->sched_timer);
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	sl->sched_active = LIN_SCHED_TABLE_NONE;
+	clear_bit(SLF_SCHEDEVENT, &sl->flags);
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+}
+
+static void sllin_sched_resume(struct sllin *sl)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	sllin_sched_start_locked(sl);
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+}
+
+static void sllin_sched_stop(struct sllin *sl)
+{
+	unsigned long flags;
+
+	trace_sllin_timer(sl->dev, -1, SLLIN_TRACE_TIMER_SCHED,
+		SLLIN_TRACE_TIMER_CANCEL, 0);
+	hrtimer_cancel(&sl->sched_timer);
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	sl->sched_active = LIN_SCHED_TABLE_NONE;
+	sl->sched_next = LIN_SCHED_TABLE_NONE;
+	clear_bit(SLF_SCHEDEVENT, &sl->flags);
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+}
+
+/*****************************************
+ *  Diagnostic transport layer
+ *****************************************/
+
+/*
+ * Master request (ID 0x3C) and slave response (ID 0x3D) frames carry
+ * NAD, PCI and up to 6 data bytes of the diagnostic PDU:
+ *   SF: PCI = 0x0L,        L data bytes
+ *   FF: PCI = 0x1H, LEN,   5 data bytes, length = H << 8 | LEN
+ *   CF: PCI = 0x2N,        6 data bytes, N = sequence number
+ * The frames are sent by the state machine when it is idle (or in the
+ * 0x3C/0x3D slots of the running schedule table).
+ */
+
+/* Called with sm_lock held */
+static void sllin_diag_finish(struct sllin *sl, int res)
+{
+	sl->diag.result = res;
+	sl->diag.state = SLLIN_DIAG_DONE;
+	clear_bit(SLF_DIAGEVENT, &sl->flags);
+	wake_up(&sl->diag_wq);
+}
+
+/* Build next master request frame */
+static void sllin_diag_encode(struct sllin_diag *d, struct can_frame *cf)
+{
+	struct lin_diag_transfer *xfer = d->xfer;
+	int len = xfer->len;
+	int n;
+
+	cf->can_id = LIN_DIAG_MASTER_REQ_ID;
+	cf->can_dlc = SLLIN_DATA_MAX;
+	memset(cf->data, 0xff, SLLIN_DATA_MAX);
+	cf->data[0] = xfer->nad;
+
+	if ((d->req_pos == 0) && (len <= 6)) {
+		cf->data[1] = len;
+		memcpy(&cf->data[2], xfer->data, len);
+		d->req_pos = len;
+	} else if (d->req_pos == 0) {
+		cf->data[1] = 0x10 | (len >> 8);
+		cf->data[2] = len & 0xff;
+		memcpy(&cf->data[3], xfer->data, 5);
+		d->req_pos = 5;
+		d->req_sn = 1;
+	} else {
+		n = min(6, len - d->req_pos);
+		cf->data[1] = 0x20 | (d->req_sn & 0x0f);
+		memcpy(&cf->data[2], xfer->data + d->req_pos, n);
+		d->req_pos += n;
+		d->req_sn++;
+	}
+
+	if (d->req_pos >= len)
+		d->state = SLLIN_DIAG_REQ_SENT;
+}
+
+/*
+ * sllin_diag_sched_ok() -- Check the schedule table carries diagnostics
+ *
+ * Returns false when the table being run (or switched to) has no slot
+ * for the master request or the expected slave response frames.
+ */
+static bool sllin_diag_sched_ok(struct sllin *sl, bool resp)
+{
+	struct lin_sched_table *tbl;
+	unsigned long flags;
+	bool req_slot = false;
+	bool resp_slot = false;
+	bool ret = true;
+	int i;
+
+	spin_lock_irqsave(&sl->sched_lock, flags);
+	if (sl->sched_next != LIN_SCHED_TABLE_NONE) {
+		tbl = &sl->sched_tables[sl->sched_next];
+		for (i = 0; i < tbl->slots_cnt; i++) {
+			if (tbl->slot[i].flags & LIN_SCHED_SLOT_SPORADIC)
+				continue;
+			if (tbl->slot[i].lin_id == LIN_DIAG_MASTER_REQ_ID)
+				req_slot = true;
+			if (tbl->slot[i].lin_id == LIN_DIAG_SLAVE_RESP_ID)
+				resp_slot = true;
+		}
+		ret = req_slot && (resp_slot || !resp);
+	}
+	spin_unlock_irqrestore(&sl->sched_lock, flags);
+
+	return ret;
+}
+
+static void sllin_diag_timer_arm(struct sllin *sl, ktime_t expires)
+{
+	if (ktime_after(expires, sl->diag.deadline))
+		expires = sl->diag.deadline;
+	hrtimer_start(&sl->diag_timer, expires, HRTIMER_MODE_ABS);
+}
+
+/**
+ * sllin_diag_next() -- Get next frame of the diagnostic transfer
+ *
+ * @sl:
+ * @slot_id: ID of the schedule slot the frame is requested for,
+ *	     -1 when the state machine is idle without schedule
+ * @cf:	     Frame to be sent
+ *
+ * Called with sm_lock held from the idle state machine. Returns true
+ * when @cf was filled in.
+ */
+static bool sllin_diag_next(struct sllin *sl, int slot_id, struct can_frame *cf)
+{
+	struct sllin_diag *d = &sl->diag;
+	ktime_t now = ktime_get();
+
+	if ((slot_id < 0) && (sl->sched_active != LIN_SCHED_TABLE_NONE)) {
+		/* Diagnostic frames are sent in the schedule slots */
+		clear_bit(SLF_DIAGEVENT, &sl->flags);
+		if ((d->state != SLLIN_DIAG_REQ) && (d->state != SLLIN_DIAG_RESP))
+			return false;
+	}
+
+	switch (d->state) {
+	case SLLIN_DIAG_REQ:
+		if (ktime_after(now, d->deadline)) {
+			netdev_dbg(sl->dev, "diagnostic request timeout\n");
+			sllin_diag_finish(sl, -ETIMEDOUT);
+			return false;
+		}
+
+		/* Waiting for the 0x3C slot, the table may have none */
+		if ((slot_id < 0) && (sl->sched_active != LIN_SCHED_TABLE_NONE)) {
+			sllin_diag_timer_arm(sl, d->deadline);
+			return false;
+		}
+
+		if ((slot_id >= 0) && (slot_id != LIN_DIAG_MASTER_REQ_ID))
+			return false;
+
+		sllin_diag_encode(d, cf);
+		d->deadline = ktime_add(now, d->n_cr);
+		return true;
+
+	case SLLIN_DIAG_REQ_SENT:
+		/* The last request frame has been sent */
+		if (d->xfer->flags & LIN_DIAG_NO_RESPONSE) {
+			d->xfer->len = 0;
+			sllin_diag_finish(sl, 0);
+			return false;
+		}
+
+		d->state = SLLIN_DIAG_RESP;
+		d->polled = false;
+		d->next_poll = ktime_add(now, d->p2_min);
+		d->deadline = ktime_add(now, d->p2_max);
+		/* Fall through */
+
+	case SLLIN_DIAG_RESP:
+		if (d->polled && !d->got_frame)
+			d->next_poll = ktime_add(now, d->p2_min);
+		d->polled = false;
+
+		if (ktime_after(now, d->deadline)) {
+			netdev_dbg(sl->dev, "diagnostic response timeout\n");
+			sllin_diag_finish(sl, -ETIMEDOUT);
+			return false;
+		}
+
+		if ((slot_id < 0) && (sl->sched_active != LIN_SCHED_TABLE_NONE)) {
+			sllin_diag_timer_arm(sl, d->deadline);
+			return false;
+		}
+
+		if (((slot_id >= 0) && (slot_id != LIN_DIAG_SLAVE_RESP_ID)) ||
+			ktime_before(now, d->next_poll)) {
+			clear_bit(SLF_DIAGEVENT, &sl->flags);
+			sllin_diag_timer_arm(sl, d->next_poll);
+			return false;
 		}
 
-		wait_event_killable(sl->kwt_wq, kthread_should_stop() ||
-			test_bit(SLF_RXEVENT, &sl->flags) ||
-			test_bit(SLF_TXEVENT, &sl->flags) ||
-			test_bit(SLF_TMOUTEVENT, &sl->flags) ||
-			test_bit(SLF_ERROR, &sl->flags) ||
-			(sl->lin_state == SLSTATE_ID_RECEIVED) ||
-			(((sl->lin_state == SLSTATE_IDLE) ||
-				(sl->lin_state == SLSTATE_RESPONSE_WAIT))
-				&& test_bit(SLF_MSGEVENT, &sl->flags)));
-
-		if (test_and_clear_bit(SLF_RXEVENT, &sl->flags)) {
-			netdev_dbg(sl->dev, "sllin_kthread RXEVENT\n");
+		cf->can_id = LIN_DIAG_SLAVE_RESP_ID | CAN_RTR_FLAG;
+		cf->can_dlc = SLLIN_DATA_MAX;
+		d->polled = true;
+		d->got_frame = false;
+		return true;
+
+	default:
+		clear_bit(SLF_DIAGEVENT, &sl->flags);
+		return false;
+	}
+}
+
+/*
+ * sllin_diag_rx() -- Process slave response frame (ID 0x3D),
+ *		      called with sm_lock held
+ */
+static void sllin_diag_rx(struct sllin *sl, unsigned char *data, int len)
+{
+	struct sllin_diag *d = &sl->diag;
+	struct lin_diag_transfer *xfer = d->xfer;
+	ktime_t now = ktime_get();
+	int n;
+
+	if ((d->state != SLLIN_DIAG_RESP) || (len != SLLIN_DATA_MAX))
+		return;
+
+	/* Response of other slave */
+	if ((xfer->nad != LIN_DIAG_NAD_FUNCTIONAL) && (data[0] != xfer->nad))
+		return;
+
+	d->got_frame = true;
+	d->next_poll = now;
+	d->deadline = ktime_add(now, d->n_cr);
+
+	switch (data[1] >> 4) {
+	case 0: /* SF */
+		if (d->resp_len)
+			break;
+		n = data[1] & 0x0f;
+		if ((n < 1) || (n > 6))
+			break;
+
+		/* Negative response 0x78 -- response pending */
+		if ((n >= 3) && (data[2] == 0x7f) && (data[4] == 0x78)) {
+			d->deadline = ktime_add(now, d->p2_max);
+			d->next_poll = ktime_add(now, d->p2_min);
+			return;
 		}
 
-		if (test_and_clear_bit(SLF_ERROR, &sl->flags)) {
-			unsigned long usleep_range_min;
-			unsigned long usleep_range_max;
-			hrtimer_cancel(&sl->rx_timer);
-			netdev_dbg(sl->dev, "sllin_kthread ERROR\n");
+		xfer->nad = data[0];
+		xfer->len = n;
+		memcpy(xfer->data, &data[2], n);
+		sllin_diag_finish(sl, 0);
+		return;
+
+	case 1: /* FF */
+		if (d->resp_len)
+			break;
+		n = ((data[1] & 0x0f) << 8) | data[2];
+		if (n <= 6)
+			break;
+
+		xfer->nad = data[0];
+		d->resp_len = n;
+		memcpy(xfer->data, &data[3], 5);
+		d->resp_pos = 5;
+		d->resp_sn = 1;
+		return;
+
+	case 2: /* CF */
+		if (!d->resp_len || ((data[1] & 0x0f) != (d->resp_sn & 0x0f)))
+			break;
+
+		n = min(6, d->resp_len - d->resp_pos);
+		memcpy(xfer->data + d->resp_pos, &data[2], n);
+		d->resp_pos += n;
+		d->resp_sn++;
+		if (d->resp_pos >= d->resp_len) {
+			xfer->len = d->resp_len;
+			sllin_diag_finish(sl, 0);
+		}
+		return;
+	}
+
+	netdev_dbg(sl->dev, "invalid diagnostic response PCI 0x%02x\n", data[1]);
+	sllin_diag_finish(sl, -EIO);
+}
+
+/* Error reported for frame with given ID, called with sm_lock held */
+static void sllin_diag_error(struct sllin *sl, int lin_id)
+{
+	struct sllin_diag *d = &sl->diag;
+
+	/* Lost master request frame breaks the whole request */
+	if ((lin_id == LIN_DIAG_MASTER_REQ_ID) &&
+		((d->state == SLLIN_DIAG_REQ) || (d->state == SLLIN_DIAG_REQ_SENT)))
+		sllin_diag_finish(sl, -EIO);
+}
+
+static enum hrtimer_restart sllin_diag_timer_handler(struct hrtimer *hrtimer)
+{
+	struct sllin *sl = container_of(hrtimer, struct sllin, diag_timer);
+
+	set_bit(SLF_DIAGEVENT, &sl->flags);
+	sllin_sm_kick(sl);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Abort running transfer (interface going down) */
+static void sllin_diag_abort(struct sllin *sl, int err)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	if ((sl->diag.state != SLLIN_DIAG_NONE) &&
+		(sl->diag.state != SLLIN_DIAG_DONE))
+		sllin_diag_finish(sl, err);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+}
+
+/**
+ * sllin_diag_transfer() -- Send diagnostic request and receive response
+ *
+ * @sl:
+ * @uxfer: Pointer to struct lin_diag_transfer in userspace, overwritten
+ *	   by the response
+ */
+static int sllin_diag_transfer(struct sllin *sl,
+		struct lin_diag_transfer __user *uxfer)
+{
+	struct lin_diag_transfer *xfer;
+	struct sllin_diag *d = &sl->diag;
+	unsigned long flags;
+	int ret;
+
+	if (!sl->lin_master)
+		return -EOPNOTSUPP;
+
+	xfer = kmalloc(sizeof(*xfer), GFP_KERNEL);
+	if (!xfer)
+		return -ENOMEM;
+
+	if (copy_from_user(xfer, uxfer, sizeof(*xfer))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	if ((xfer->len == 0) || (xfer->len > LIN_DIAG_PDU_MAX)) {
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (mutex_lock_interruptible(&sl->diag_mutex)) {
+		ret = -ERESTARTSYS;
+		goto out_free;
+	}
+
+	if (!netif_running(sl->dev)) {
+		ret = -ENETDOWN;
+		goto out_unlock;
+	}
+
+	if (!sllin_diag_sched_ok(sl, !(xfer->flags & LIN_DIAG_NO_RESPONSE))) {
+		ret = -EOPNOTSUPP;
+		goto out_unlock;
+	}
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	memset(d, 0, sizeof(*d));
+	d->xfer = xfer;
+	d->p2_min = ns_to_ktime((u64)(xfer->p2_min_us ? xfer->p2_min_us :
+		SLLIN_DIAG_P2_MIN_US) * NSEC_PER_USEC);
+	d->p2_max = ns_to_ktime((u64)(xfer->p2_max_ms ? xfer->p2_max_ms :
+		SLLIN_DIAG_P2_MAX_MS) * NSEC_PER_MSEC);
+	d->n_cr = ns_to_ktime((u64)(xfer->n_cr_ms ? xfer->n_cr_ms :
+		SLLIN_DIAG_N_CR_MS) * NSEC_PER_MSEC);
+	d->deadline = ktime_add(ktime_get(), d->n_cr);
+	d->state = SLLIN_DIAG_REQ;
+	set_bit(SLF_DIAGEVENT, &sl->flags);
+	sllin_sm_run(sl);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+	sllin_rx_flush(sl);
+
+	ret = wait_event_interruptible(sl->diag_wq,
+		sl->diag.state == SLLIN_DIAG_DONE);
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	if (d->state == SLLIN_DIAG_DONE)
+		ret = d->result;
+	d->state = SLLIN_DIAG_NONE;
+	d->xfer = NULL;
+	clear_bit(SLF_DIAGEVENT, &sl->flags);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+	hrtimer_cancel(&sl->diag_timer);
+
+	if ((ret == 0) && copy_to_user(uxfer, xfer, sizeof(*xfer)))
+		ret = -EFAULT;
+
+out_unlock:
+	mutex_unlock(&sl->diag_mutex);
+out_free:
+	kfree(xfer);
+	return ret;
+}
+
+/*****************************************
+ *  Event triggered frames
+ *****************************************/
+
+/*
+ * More slaves may respond to the header of an event triggered frame.
+ * Their responses collide, which shows as a checksum or framing error.
+ * The driver then sends the headers of all associated unconditional
+ * frames itself (before any other frame, or in place of the schedule
+ * table slots when a table is running) and their responses are
+ * delivered as usual.
+ */
+
+/**
+ * sllin_evt_collision() -- Check error of event triggered frame
+ *
+ * @sl:
+ * @lin_id: ID of the frame the error is reported for
+ * @err:    LIN_ERR_*
+ *
+ * Called with sm_lock held. Returns true when the error is handled
+ * here and is not to be reported.
+ */
+static bool sllin_evt_collision(struct sllin *sl, int lin_id, int err)
+{
+	struct sllin_evt *evt = &sl->evt[lin_id];
+
+	if (!sl->lin_master || !evt->assoc_cnt ||
+		((sl->lin_state != SLSTATE_RESPONSE_WAIT) &&
+		 (sl->lin_state != SLSTATE_RESPONSE_WAIT_BUS)))
+		return false;
+
+	/* No slave has anything to report -- not an error */
+	if ((err == LIN_ERR_RX_TIMEOUT) && (sl->rx_cnt <= SLLIN_BUFF_DATA))
+		return true;
+
+	netdev_dbg(sl->dev, "collision of event triggered frame ID %d\n",
+		lin_id);
+	sl->id_stats[lin_id].collisions++;
+
+	/* Collision during resolution -- the frames are read anyway */
+	if (sl->evt_resolve_pos < sl->evt_resolve_cnt)
+		return true;
+
+	memcpy(sl->evt_resolve, evt->assoc, evt->assoc_cnt);
+	sl->evt_resolve_cnt = evt->assoc_cnt;
+	sl->evt_resolve_pos = 0;
+
+	return true;
+}
+
+/* Next header resolving the collision, called with sm_lock held */
+static bool sllin_evt_next(struct sllin *sl, struct can_frame *cf)
+{
+	if (sl->evt_resolve_pos >= sl->evt_resolve_cnt)
+		return false;
+
+	cf->can_id = sl->evt_resolve[sl->evt_resolve_pos++] | CAN_RTR_FLAG;
+	cf->can_dlc = 0;
+	return true;
+}
+
+static int sllin_evt_set(struct sllin *sl, struct lin_evt_frame __user *uevt)
+{
+	struct lin_evt_frame evt;
+	unsigned long flags;
+	int i;
+
+	if (copy_from_user(&evt, uevt, sizeof(evt)))
+		return -EFAULT;
+
+	if ((evt.lin_id > LIN_ID_MAX) || (evt.assoc_cnt > LIN_EVT_ASSOC_MAX))
+		return -EINVAL;
+
+	for (i = 0; i < evt.assoc_cnt; i++) {
+		if ((evt.assoc[i] > LIN_ID_MAX) || (evt.assoc[i] == evt.lin_id))
+			return -EINVAL;
+	}
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	memcpy(sl->evt[evt.lin_id].assoc, evt.assoc, evt.assoc_cnt);
+	sl->evt[evt.lin_id].assoc_cnt = evt.assoc_cnt;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	return 0;
+}
+
+/*****************************************
+ *  sllin state machine
+ *****************************************/
+
+/**
+ * sllin_sm_run() -- Advance the LIN state machine as far as possible
+ *
+ * @sl:
+ *
+ * Called with sm_lock held from every place where an event happens --
+ * sllin_receive_buf(), sll_xmit(), the hrtimer handlers and the worker
+ * (after a break was generated). Never sleeps; when the current state
+ * waits for another event, it just returns.
+ */
+static void sllin_sm_run(struct sllin *sl)
+{
+	struct sk_buff *skb;
+	struct can_frame *cf;
+	struct can_frame sched_cf;
+	struct lin_sched_slot slot;
+	struct sllin_conf_entry sce;
+	unsigned long flags;
+	int tx_bytes; /* Used for Network statistics */
+	int mode;
+	int lin_id;
+	u8 *lin_data;
+	int lin_dlc;
 
-			if (sl->lin_state != SLSTATE_IDLE)
-				sllin_report_error(sl, LIN_ERR_FRAMING);
+	for (;;) {
+		/* Waiting for the bus to become idle after an error */
+		if (test_bit(SLF_ERROR, &sl->flags))
+			return;
 
-			usleep_range_min = (1000000l * SLLIN_SAMPLES_PER_CHAR * 10) /
-						sl->lin_baud;
-			usleep_range_max = usleep_range_min + 50;
-			usleep_range(usleep_range_min, usleep_range_max);
-			sllin_reset_buffs(sl);
-			sl->lin_state = SLSTATE_IDLE;
-		}
+		tx_bytes = 0;
 
-		if (test_and_clear_bit(SLF_TXEVENT, &sl->flags)) {
-			netdev_dbg(sl->dev, "sllin_kthread TXEVENT\n");
-		}
+		switch (sl->lin_state) {
+		case SLSTATE_IDLE:
+#ifdef BREAK_BY_BAUD
+			/* UART still runs at the break rate */
+			if (sl->break_phase != SLLIN_BREAK_NONE)
+				return;
+#endif
+			if (test_and_clear_bit(SLF_SCHEDEVENT, &sl->flags)) {
+				/* Header requested by the schedule table executor */
+				spin_lock_irqsave(&sl->sched_lock, flags);
+				slot = sl->sched_cur;
+				spin_unlock_irqrestore(&sl->sched_lock, flags);
+
+				lin_id = sllin_sched_slot_id(sl, &slot);
+				sched_cf.can_id = (lin_id & LIN_ID_MASK) | CAN_RTR_FLAG;
+				sched_cf.can_dlc = 0;
+
+				/* Collision resolution replaces the slots,
+				   diagnostic frames use 0x3C/0x3D ones */
+				if (!sllin_evt_next(sl, &sched_cf)) {
+					/* Empty sporadic slot */
+					if (lin_id < 0)
+						break;
+
+					/* Empty master request slot stays silent */
+					if ((lin_id == LIN_DIAG_MASTER_REQ_ID) &&
+						!sllin_diag_next(sl, lin_id, &sched_cf))
+						break;
+
+					if (lin_id == LIN_DIAG_SLAVE_RESP_ID)
+						sllin_diag_next(sl, lin_id, &sched_cf);
+				}
 
-		if (test_and_clear_bit(SLF_TMOUTEVENT, &sl->flags)) {
-			netdev_dbg(sl->dev, "sllin_kthread TMOUTEVENT\n");
-			sllin_reset_buffs(sl);
+				skb = NULL;
+				cf = &sched_cf;
+			} else if ((sl->sched_active == LIN_SCHED_TABLE_NONE) &&
+				sllin_evt_next(sl, &sched_cf)) {
+				/* Collision resolution goes first */
+				skb = NULL;
+				cf = &sched_cf;
+			} else if (test_bit(SLF_DIAGEVENT, &sl->flags) &&
+				sllin_diag_next(sl, -1, &sched_cf)) {
+				skb = NULL;
+				cf = &sched_cf;
+			} else {
+				if (!test_bit(SLF_MSGEVENT, &sl->flags))
+					return;
 
-			sl->lin_state = SLSTATE_IDLE;
-		}
+				skb = sllin_tx_queue_next(sl);
+				if (skb == NULL)
+					return;
 
-		switch (sl->lin_state) {
-		case SLSTATE_IDLE:
-			if (!test_bit(SLF_MSGEVENT, &sl->flags))
-				break;
+				cf = (struct can_frame *)skb->data;
+			}
 
 			mode = 0;
-			cf = (struct can_frame *)sl->tx_req_skb->data;
 
 			if (cf->can_id & LIN_CHECKSUM_EXTENDED)
 				mode |= SLLIN_STPMSG_CHCKSUM_ENH;
@@ -1255,38 +3289,42 @@ static int sllin_kwthread(void *ptr)
 				netdev_dbg(sl->dev, "%s: RTR SFF CAN frame, ID = %x\n",
 					__func__, cf->can_id & LIN_ID_MASK);
 
-				sce = &sl->linfr_cache[cf->can_id & LIN_ID_MASK];
-				spin_lock_irqsave(&sl->linfr_lock, flags);
-				if (sce->frame_fl & LIN_CHECKSUM_EXTENDED)
+				lin_id = cf->can_id & LIN_ID_MASK;
+				sllin_cache_read(sl, lin_id, &sce);
+				if (sce.frame_fl & LIN_CHECKSUM_EXTENDED)
 					mode |= SLLIN_STPMSG_CHCKSUM_ENH;
 
 				/* Is there Slave response in linfr_cache to be sent? */
-				if ((sce->frame_fl & LIN_CACHE_RESPONSE)
-					&& (sce->dlc > 0)) {
+				if ((sce.frame_fl & LIN_CACHE_RESPONSE)
+					&& (sce.dlc > 0)) {
 
-					if (sce->frame_fl & LIN_SINGLE_RESPONSE)
-						sce->frame_fl &= ~LIN_CACHE_RESPONSE;
+					if (sce.updated ||
+						(sce.frame_fl & LIN_SINGLE_RESPONSE))
+						sllin_cache_response_sent(sl, lin_id);
 
 					netdev_dbg(sl->dev, "Sending LIN response from linfr_cache\n");
 
-					lin_data = sce->data;
-					lin_dlc = sce->dlc;
+					lin_data = sce.data;
+					lin_dlc = sce.dlc;
 					if (lin_dlc > SLLIN_DATA_MAX)
 						lin_dlc = SLLIN_DATA_MAX;
-					memcpy(lin_data_buff, lin_data, lin_dlc);
-					lin_data = lin_data_buff;
 				} else {
 					lin_data = NULL;
-					lin_dlc = sce->dlc;
+					lin_dlc = sce.dlc;
+					/* Diagnostic slave response poll knows the
+					   length, can_dlc of RTR frames from the
+					   socket is ignored */
+					if ((lin_dlc <= 0) && (skb == NULL))
+						lin_dlc = min_t(int, cf->can_dlc,
+							SLLIN_DATA_MAX);
 				}
-				spin_unlock_irqrestore(&sl->linfr_lock, flags);
 
 			} else { /* SFF NON-RTR CAN frame -> LIN header + LIN response */
 				netdev_dbg(sl->dev, "%s: NON-RTR SFF CAN frame, ID = %x\n",
 					__func__, (int)cf->can_id & LIN_ID_MASK);
 
-				sce = &sl->linfr_cache[cf->can_id & LIN_ID_MASK];
-				if (sce->frame_fl & LIN_CHECKSUM_EXTENDED)
+				sllin_cache_read(sl, cf->can_id & LIN_ID_MASK, &sce);
+				if (sce.frame_fl & LIN_CHECKSUM_EXTENDED)
 					mode |= SLLIN_STPMSG_CHCKSUM_ENH;
 
 				lin_data = cf->data;
@@ -1306,58 +3344,72 @@ static int sllin_kwthread(void *ptr)
 				sl->dev->stats.tx_bytes += tx_bytes;
 			}
 
-			clear_bit(SLF_MSGEVENT, &sl->flags);
-			kfree_skb(sl->tx_req_skb);
-			netif_wake_queue(sl->dev);
-			hrtimer_start(&sl->rx_timer,
-				ktime_add(ktime_get(), sl->rx_timer_timeout),
-				HRTIMER_MODE_ABS);
+			kfree_skb(skb);
+			sllin_rx_timer_start(sl, sl->rx_timer_timeout);
+
+			if (sl->lin_master && sl->id_to_send) {
+				/* Break is generated by the worker */
+				sl->rx_cnt = SLLIN_BUFF_BREAK;
+				sl->rx_expect = SLLIN_BUFF_BREAK + 1;
+				sllin_set_state(sl, SLSTATE_BREAK_SENT);
+				set_bit(SLF_BREAKRQ, &sl->flags);
+				sllin_worker_queue(sl);
+				return;
+			}
 			break;
 
 		case SLSTATE_BREAK_SENT:
-#ifdef BREAK_BY_BAUD
-			if (sl->rx_cnt <= SLLIN_BUFF_BREAK)
-				continue;
-
-			res = sltty_change_speed(tty, sl->lin_baud);
-#endif
+			if (test_bit(SLF_BREAKRQ, &sl->flags))
+				return;
 
-			sl->lin_state = SLSTATE_ID_SENT;
+			sllin_set_state(sl, SLSTATE_ID_SENT);
+			sl->id_stats[sl->tx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK].headers++;
 			sllin_send_tx_buff(sl);
 			break;
 
 		case SLSTATE_ID_SENT:
-			hrtimer_cancel(&sl->rx_timer);
+			if (sl->rx_cnt < sl->rx_expect)
+				return;
+
+			sllin_rx_timer_stop(sl);
 			sl->id_to_send = false;
+			lin_id = sl->tx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
 			if (sl->data_to_send) {
 				sllin_send_tx_buff(sl);
-				sl->lin_state = SLSTATE_RESPONSE_SENT;
+				sllin_set_state(sl, SLSTATE_RESPONSE_SENT);
 				sl->rx_expect = sl->tx_lim;
-				goto slstate_response_sent;
+				/* Echo of our own response */
+				sllin_rx_timer_start(sl, sllin_resp_timeout(sl,
+					lin_id, sl->tx_lim - SLLIN_BUFF_DATA - 1));
 			} else {
 				if (sl->resp_len_known) {
 					sl->rx_expect = sl->rx_lim;
 				} else {
-					sl->rx_expect = SLLIN_BUFF_DATA + 2;
+					/* Ended by inter-byte gap if shorter */
+					sl->rx_expect = SLLIN_BUFF_DATA +
+						SLLIN_DATA_MAX + 1;
 				}
-				sl->lin_state = SLSTATE_RESPONSE_WAIT;
+				sllin_set_state(sl, SLSTATE_RESPONSE_WAIT);
 				/* If we don't receive anything, timer will "unblock" us */
-				hrtimer_start(&sl->rx_timer,
-					ktime_add(ktime_get(), sl->rx_timer_timeout),
-					HRTIMER_MODE_ABS);
-				goto slstate_response_wait;
+				sllin_rx_timer_start(sl, sllin_resp_timeout(sl, lin_id,
+					sl->resp_len_known ?
+					sl->rx_lim - SLLIN_BUFF_DATA - 1 : 0));
 			}
 			break;
 
 		case SLSTATE_RESPONSE_WAIT:
-slstate_response_wait:
-			if (test_bit(SLF_MSGEVENT, &sl->flags)) {
+			skb = skb_peek(&sl->tx_queue);
+			if (skb != NULL) {
 				unsigned char *lin_buff;
-				cf = (struct can_frame *)sl->tx_req_skb->data;
+				cf = (struct can_frame *)skb->data;
 
 				lin_buff = (sl->lin_master) ? sl->tx_buff : sl->rx_buff;
 				if (cf->can_id == (lin_buff[SLLIN_BUFF_ID] & LIN_ID_MASK)) {
-					hrtimer_cancel(&sl->rx_timer);
+					/* The response is the oldest frame in
+					   tx_queue; we are its only consumer */
+					skb = sllin_tx_queue_next(sl);
+					cf = (struct can_frame *)skb->data;
+					sllin_rx_timer_stop(sl);
 					netdev_dbg(sl->dev, "received LIN response in a CAN frame.\n");
 					if (sllin_setup_msg(sl, SLLIN_STPMSG_RESPONLY,
 						cf->can_id & LIN_ID_MASK,
@@ -1366,31 +3418,30 @@ slstate_response_wait:
 						sl->rx_expect = sl->tx_lim;
 						sl->data_to_send = true;
 						sl->dev->stats.tx_packets++;
-						sl->dev->stats.tx_bytes += tx_bytes;
+						sl->dev->stats.tx_bytes += cf->can_dlc;
 
 						if (!sl->lin_master) {
 							sl->tx_cnt = SLLIN_BUFF_DATA;
 						}
 
 						sllin_send_tx_buff(sl);
-						clear_bit(SLF_MSGEVENT, &sl->flags);
-						kfree_skb(sl->tx_req_skb);
-						netif_wake_queue(sl->dev);
+						kfree_skb(skb);
 
-						sl->lin_state = SLSTATE_RESPONSE_SENT;
-						goto slstate_response_sent;
+						sllin_set_state(sl, SLSTATE_RESPONSE_SENT);
+						break;
 					}
+					kfree_skb(skb);
 				} else {
-					sl->lin_state = SLSTATE_RESPONSE_WAIT_BUS;
+					sllin_set_state(sl, SLSTATE_RESPONSE_WAIT_BUS);
 				}
 			}
 
 			/* Be aware, no BREAK here */
 		case SLSTATE_RESPONSE_WAIT_BUS:
 			if (sl->rx_cnt < sl->rx_expect)
-				continue;
+				return;
 
-			hrtimer_cancel(&sl->rx_timer);
+			sllin_rx_timer_stop(sl);
 			netdev_dbg(sl->dev, "response received ID %d len %d\n",
 				sl->rx_buff[SLLIN_BUFF_ID], sl->rx_cnt - SLLIN_BUFF_DATA - 1);
 
@@ -1400,152 +3451,466 @@ slstate_response_wait:
 			} else {
 				/* Send CAN non-RTR frame with data */
 				netdev_dbg(sl->dev, "sending NON-RTR CAN frame with LIN payload.");
+				sllin_stats_response(sl);
 				sll_bump(sl); /* send packet to the network layer */
 			}
 
 			sl->id_to_send = false;
-			sl->lin_state = SLSTATE_IDLE;
+			sllin_set_state(sl, SLSTATE_IDLE);
 			break;
 
 		case SLSTATE_ID_RECEIVED:
 			lin_id = sl->rx_buff[SLLIN_BUFF_ID] & LIN_ID_MASK;
-			sce = &sl->linfr_cache[lin_id];
-			spin_lock_irqsave(&sl->linfr_lock, flags);
+			sllin_cache_read(sl, lin_id, &sce);
 
-			if ((sce->frame_fl & LIN_CACHE_RESPONSE)
-					&& (sce->dlc > 0)) {
+			if (!sl->monitor && (sce.frame_fl & LIN_CACHE_RESPONSE)
+					&& (sce.dlc > 0)) {
 
-				if (sce->frame_fl & LIN_SINGLE_RESPONSE)
-					sce->frame_fl &= ~LIN_CACHE_RESPONSE;
+				if (sce.updated ||
+					(sce.frame_fl & LIN_SINGLE_RESPONSE))
+					sllin_cache_response_sent(sl, lin_id);
 
 				netdev_dbg(sl->dev, "Sending LIN response from linfr_cache\n");
 
-				lin_data = sce->data;
-				lin_dlc = sce->dlc;
+				lin_dlc = sce.dlc;
 				if (lin_dlc > SLLIN_DATA_MAX)
 					lin_dlc = SLLIN_DATA_MAX;
-				memcpy(lin_data_buff, lin_data, lin_dlc);
-				lin_data = lin_data_buff;
-				tx_bytes = lin_dlc;
-
-				mode = SLLIN_STPMSG_RESPONLY;
-				if (sce->frame_fl & LIN_CHECKSUM_EXTENDED)
-					mode |= SLLIN_STPMSG_CHCKSUM_ENH;
-
-				if (sllin_setup_msg(sl, mode, lin_id & LIN_ID_MASK,
-					lin_data, lin_dlc) != -1) {
 
-					sl->rx_expect = sl->tx_lim;
-					sl->data_to_send = true;
-					sl->dev->stats.tx_packets++;
-					sl->dev->stats.tx_bytes += tx_bytes;
-					sl->resp_len_known = true;
+				/* Response is pre-encoded, just copy it behind the header */
+				sllin_setup_response(sl, lin_id, sce.resp, lin_dlc);
 
-					if (!sl->lin_master) {
-						sl->tx_cnt = SLLIN_BUFF_DATA;
-					}
-					sllin_send_tx_buff(sl);
-				}
+				sl->rx_expect = sl->tx_lim;
+				sl->data_to_send = true;
+				sl->dev->stats.tx_packets++;
+				sl->dev->stats.tx_bytes += lin_dlc;
+				sl->resp_len_known = true;
+				sl->tx_cnt = SLLIN_BUFF_DATA;
+				sllin_send_tx_buff(sl);
 
-				hrtimer_start(&sl->rx_timer,
-					ktime_add(ktime_get(), sl->rx_timer_timeout),
-					HRTIMER_MODE_ABS);
+				sllin_rx_timer_start(sl,
+					sllin_resp_timeout(sl, lin_id, lin_dlc));
 			}
-			spin_unlock_irqrestore(&sl->linfr_lock, flags);
-			sl->lin_state = SLSTATE_IDLE;
+			sllin_set_state(sl, SLSTATE_IDLE);
 			break;
 
 		case SLSTATE_RESPONSE_SENT:
-slstate_response_sent:
 			if (sl->rx_cnt < sl->tx_lim)
-				continue;
+				return;
 
-			hrtimer_cancel(&sl->rx_timer);
+			sllin_rx_timer_stop(sl);
 			sll_bump(sl); /* send packet to the network layer */
 			netdev_dbg(sl->dev, "response sent ID %d len %d\n",
 				sl->rx_buff[SLLIN_BUFF_ID], sl->rx_cnt - SLLIN_BUFF_DATA - 1);
 
 			sl->id_to_send = false;
-			sl->lin_state = SLSTATE_IDLE;
+			sllin_set_state(sl, SLSTATE_IDLE);
 			break;
 		}
 	}
+}
 
-	hrtimer_cancel(&sl->rx_timer);
-	netdev_dbg(sl->dev, "sllin_kwthread stopped.\n");
+/* Run the state machine from a context not holding sm_lock */
+static void sllin_sm_kick(struct sllin *sl)
+{
+	unsigned long flags;
 
-	return 0;
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	sllin_sm_run(sl);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+	sllin_rx_flush(sl);
 }
 
+/*****************************************
+ *  Worker pool
+ *
+ *  Workers handle only the operations which might sleep.
+ *****************************************/
 
-/************************************
- *  sllin_open helper routines.
- ************************************/
+static void sllin_work(struct kthread_work *work)
+{
+	struct sllin *sl = container_of(work, struct sllin, work);
+	unsigned long flags;
+
+	/*
+	 * The rest of the erroneous frame is dropped until the bus is idle
+	 * for sllin_gap_timeout(). The receive routine rearms rx_timer on
+	 * each chunk and its handler clears SLF_ERROR.
+	 */
+	if (test_bit(SLF_ERROR, &sl->flags) && !sl->rx_timer_armed) {
+		netdev_dbg(sl->dev, "sllin_work ERROR\n");
+
+		sllin_break_abort(sl);
+
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		if (sl->lin_state != SLSTATE_IDLE)
+			sllin_report_error(sl, LIN_ERR_FRAMING);
+		/* Pending break request is cancelled as well */
+		clear_bit(SLF_BREAKRQ, &sl->flags);
+		sllin_reset_buffs(sl);
+		sllin_set_state(sl, SLSTATE_IDLE);
+		sllin_rx_timer_start(sl, sllin_gap_timeout(sl));
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+	}
+
+	if (test_bit(SLF_BAUDRQ, &sl->flags)) {
+		int baud;
+
+		spin_lock_irqsave(&sl->sm_lock, flags);
+		baud = sl->autobaud_rate;
+		sl->lin_baud = baud;
+		sllin_timing_update(sl);
+		spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+		if (!test_bit(SLF_STOPPING, &sl->flags))
+			sltty_change_speed(sl->tty, baud);
+		clear_bit(SLF_BAUDRQ, &sl->flags);
+	}
+
+	if (test_bit(SLF_BREAKRQ, &sl->flags)) {
+		int res = -ENODEV;
+
+		if (!test_bit(SLF_STOPPING, &sl->flags))
+			res = sllin_send_break(sl);
+
+		if (res < 0) {
+			netdev_dbg(sl->dev, "Break generation failed\n");
+			sllin_break_abort(sl);
+
+			spin_lock_irqsave(&sl->sm_lock, flags);
+			clear_bit(SLF_BREAKRQ, &sl->flags);
+			sllin_rx_timer_stop(sl);
+			sllin_reset_buffs(sl);
+			sllin_set_state(sl, SLSTATE_IDLE);
+			sllin_sm_run(sl);
+			spin_unlock_irqrestore(&sl->sm_lock, flags);
+		}
+	}
+
+	sllin_rx_flush(sl);
+}
+
+/*
+ * Might be called from any context, with sm_lock held. Nothing is
+ * queued while sllin_worker_assign() moves the channel.
+ */
+static void sllin_worker_queue(struct sllin *sl)
+{
+	if (sl->worker)
+		kthread_queue_work(&sl->worker->worker, &sl->work);
+}
 
-/* Collect hanged up channels */
-static void sll_sync(void)
+static struct sllin_worker *sllin_worker_for_cpu(int cpu)
 {
 	int i;
-	struct net_device *dev;
-	struct sllin	  *sl;
 
-	for (i = 0; i < maxdev; i++) {
-		dev = sllin_devs[i];
-		if (dev == NULL)
-			break;
+	for (i = 0; i < sllin_workers_cnt; i++)
+		if (sllin_workers[i].cpu == cpu)
+			return &sllin_workers[i];
 
-		sl = netdev_priv(dev);
-		if (sl->tty)
-			continue;
-		if (dev->flags & IFF_UP)
-			dev_close(dev);
-	}
+	return NULL;
+}
+
+/**
+ * sllin_worker_assign() -- Select the worker serving particular channel
+ *
+ * @sl:
+ * @cpu: CPU the channel should be served on, -1 means any
+ *
+ * Channels without any preference are spread over all workers.
+ * Called with the channel idle (interface down or not registered yet).
+ */
+static int sllin_worker_assign(struct sllin *sl, int cpu)
+{
+	struct sllin_worker *w;
+	unsigned long flags;
+	bool moving;
+
+	if (cpu < 0)
+		w = &sllin_workers[sl->dev->base_addr % sllin_workers_cnt];
+	else
+		w = sllin_worker_for_cpu(cpu);
+
+	if (w == NULL)
+		return -EINVAL;
+
+	/*
+	 * Do not let the work run on two workers at once. work->worker
+	 * keeps pointing to the previous worker after the flush, so the
+	 * work is initialized again before it is queued to the new one.
+	 */
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	moving = (sl->worker != NULL);
+	sl->worker = NULL;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	if (moving)
+		kthread_flush_work(&sl->work);
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	kthread_init_work(&sl->work, sllin_work);
+	sl->worker = w;
+	sl->worker_cpu = cpu;
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+	netdev_dbg(sl->dev, "served by worker on CPU %d\n", w->cpu);
+
+	return 0;
 }
 
-/* Find a free SLLIN channel, and link in this `tty' line. */
-static struct sllin *sll_alloc(dev_t line)
+static void sllin_workers_destroy(void)
 {
 	int i;
-	struct net_device *dev = NULL;
-	struct sllin       *sl;
 
-	if (sllin_devs == NULL)
-		return NULL;	/* Master array missing ! */
+	for (i = 0; i < sllin_workers_cnt; i++)
+		kthread_stop(sllin_workers[i].task);
+
+	kfree(sllin_workers);
+	sllin_workers = NULL;
+	sllin_workers_cnt = 0;
+}
+
+/* Workers are bound to the first @workers online CPUs, one on each */
+static int sllin_workers_create(void)
+{
+	struct sched_param schparam = { .sched_priority = rtprio };
+	struct sllin_worker *w;
+	int cnt = num_online_cpus();
+	int cpu;
+
+	if ((workers > 0) && (workers < cnt))
+		cnt = workers;
+
+	sllin_workers = kcalloc(cnt, sizeof(*sllin_workers), GFP_KERNEL);
+	if (!sllin_workers)
+		return -ENOMEM;
 
-	for (i = 0; i < maxdev; i++) {
-		dev = sllin_devs[i];
-		if (dev == NULL)
+	for_each_online_cpu(cpu) {
+		if (sllin_workers_cnt >= cnt)
 			break;
 
+		w = &sllin_workers[sllin_workers_cnt];
+		kthread_init_worker(&w->worker);
+		w->cpu = cpu;
+		w->task = kthread_create_on_node(kthread_worker_fn, &w->worker,
+				cpu_to_node(cpu), "sllin/%d", cpu);
+		if (IS_ERR(w->task)) {
+			sllin_workers_destroy();
+			return -ENOMEM;
+		}
+
+		kthread_bind(w->task, cpu);
+		sched_setscheduler(w->task, SCHED_FIFO, &schparam);
+		wake_up_process(w->task);
+		sllin_workers_cnt++;
 	}
 
-	/* Sorry, too many, all slots in use */
-	if (i >= maxdev)
-		return NULL;
+	return 0;
+}
 
-	if (dev) {
-		sl = netdev_priv(dev);
-		if (test_bit(SLF_INUSE, &sl->flags)) {
-			unregister_netdevice(dev);
-			dev = NULL;
-			sllin_devs[i] = NULL;
-		}
+
+/*****************************************
+ *  Per channel configuration (rtnetlink)
+ *
+ *  IFLA_SLLIN_* attributes of "sllin" link kind
+ *****************************************/
+
+/*
+ * Derive bit timing of the channel from lin_baud. Called with sm_lock
+ * held or before the channel is used.
+ */
+static void sllin_timing_update(struct sllin *sl)
+{
+	if (sl->hdr_timeout_us)
+		sl->rx_timer_timeout = ns_to_ktime((u64)sl->hdr_timeout_us *
+			NSEC_PER_USEC);
+	else
+		sl->rx_timer_timeout = ns_to_ktime(
+			(1000000000l / sl->lin_baud) *
+			SLLIN_SAMPLES_PER_CHAR * SLLIN_CHARS_TO_TIMEOUT);
+
+#ifndef BREAK_BY_BAUD
+	/* Break is 10 bits and delimiter 1 bit at 2/3 of lin_baud */
+	sl->break_len = ns_to_ktime(div_u64((u64)NSEC_PER_SEC *
+		SLLIN_SAMPLES_PER_CHAR * 3, sl->lin_baud * 2));
+	sl->break_delim_len = ns_to_ktime(div_u64((u64)NSEC_PER_SEC *
+		3, sl->lin_baud * 2));
+#endif
+}
+
+static const struct nla_policy sllin_policy[IFLA_SLLIN_MAX + 1] = {
+	[IFLA_SLLIN_MASTER]	= { .type = NLA_U8 },
+	[IFLA_SLLIN_BITRATE]	= { .type = NLA_U32 },
+	[IFLA_SLLIN_TIMEOUT]	= { .type = NLA_U32 },
+	[IFLA_SLLIN_AUTOBAUD]	= { .type = NLA_U8 },
+	[IFLA_SLLIN_MONITOR]	= { .type = NLA_U8 },
+};
+
+static int sllin_validate(struct nlattr *tb[], struct nlattr *data[])
+{
+	if (data && data[IFLA_SLLIN_BITRATE] &&
+		(nla_get_u32(data[IFLA_SLLIN_BITRATE]) == 0))
+		return -EINVAL;
+
+	/* Monitor is a listen only Slave */
+	if (data && data[IFLA_SLLIN_MASTER] && data[IFLA_SLLIN_MONITOR] &&
+		nla_get_u8(data[IFLA_SLLIN_MASTER]) &&
+		nla_get_u8(data[IFLA_SLLIN_MONITOR]))
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Channels are created by attaching the line discipline only */
+static int sllin_newlink(struct net *src_net, struct net_device *dev,
+			 struct nlattr *tb[], struct nlattr *data[])
+{
+	return -EOPNOTSUPP;
+}
+
+static void sllin_dellink(struct net_device *dev, struct list_head *head)
+{
+	/* Removed by detaching the line discipline */
+}
+
+/*
+ * Called with RTNL held. Mode and bitrate can be changed only when the
+ * interface is down, the timeout at any time.
+ */
+static int sllin_changelink(struct net_device *dev, struct nlattr *tb[],
+			    struct nlattr *data[])
+{
+	struct sllin *sl = netdev_priv(dev);
+	unsigned long flags;
+	int baud = 0;
+
+	if (!data)
+		return 0;
+
+	/* sllin_close() clears sl->tty under RTNL */
+	if (!sl->tty)
+		return -ENODEV;
+
+	if ((data[IFLA_SLLIN_MASTER] || data[IFLA_SLLIN_BITRATE] ||
+		data[IFLA_SLLIN_AUTOBAUD] || data[IFLA_SLLIN_MONITOR]) &&
+		netif_running(dev))
+		return -EBUSY;
+
+	if (data[IFLA_SLLIN_MASTER] && nla_get_u8(data[IFLA_SLLIN_MASTER]) &&
+		!data[IFLA_SLLIN_MONITOR] && sl->monitor)
+		return -EINVAL;
+
+	if (data[IFLA_SLLIN_BITRATE])
+		baud = nla_get_u32(data[IFLA_SLLIN_BITRATE]);
+
+	spin_lock_irqsave(&sl->sm_lock, flags);
+	if (data[IFLA_SLLIN_MONITOR])
+		sl->monitor = nla_get_u8(data[IFLA_SLLIN_MONITOR]) ? true : false;
+	if (data[IFLA_SLLIN_MASTER] || sl->monitor) {
+		sl->lin_master = (data[IFLA_SLLIN_MASTER] && !sl->monitor) ?
+			(nla_get_u8(data[IFLA_SLLIN_MASTER]) ? 1 : 0) : 0;
+		sllin_reset_buffs(sl);
+		sllin_set_state(sl, SLSTATE_IDLE);
+	}
+	if (baud)
+		sl->lin_baud = baud;
+	if (data[IFLA_SLLIN_AUTOBAUD]) {
+		sl->autobaud = nla_get_u8(data[IFLA_SLLIN_AUTOBAUD]) ? true : false;
+		sl->autobaud_locked = false;
+		sl->autobaud_brk = false;
+		sl->autobaud_fails = 0;
+		sl->autobaud_idx = -1;
+	}
+	if (data[IFLA_SLLIN_TIMEOUT])
+		sl->hdr_timeout_us = nla_get_u32(data[IFLA_SLLIN_TIMEOUT]);
+	sllin_timing_update(sl);
+	spin_unlock_irqrestore(&sl->sm_lock, flags);
+
+	if (baud) {
+		netdev_dbg(dev, "Baudrate set to %u\n", baud);
+		sltty_change_speed(sl->tty, baud);
 	}
 
-	if (!dev) {
-		char name[IFNAMSIZ];
-		sprintf(name, "sllin%d", i);
+	return 0;
+}
+
+static size_t sllin_get_size(const struct net_device *dev)
+{
+	return nla_total_size(sizeof(u8)) +	/* IFLA_SLLIN_MASTER */
+		nla_total_size(sizeof(u32)) +	/* IFLA_SLLIN_BITRATE */
+		nla_total_size(sizeof(u32)) +	/* IFLA_SLLIN_TIMEOUT */
+		nla_total_size(sizeof(u8)) +	/* IFLA_SLLIN_AUTOBAUD */
+		nla_total_size(sizeof(u8));	/* IFLA_SLLIN_MONITOR */
+}
+
+static int sllin_fill_info(struct sk_buff *skb, const struct net_device *dev)
+{
+	struct sllin *sl = netdev_priv(dev);
+
+	if (nla_put_u8(skb, IFLA_SLLIN_MASTER, sl->lin_master) ||
+		nla_put_u32(skb, IFLA_SLLIN_BITRATE, sl->lin_baud) ||
+		nla_put_u32(skb, IFLA_SLLIN_TIMEOUT, sl->hdr_timeout_us) ||
+		nla_put_u8(skb, IFLA_SLLIN_AUTOBAUD, sl->autobaud) ||
+		nla_put_u8(skb, IFLA_SLLIN_MONITOR, sl->monitor))
+		return -EMSGSIZE;
+
+	return 0;
+}
+
+static struct rtnl_link_ops sllin_link_ops __read_mostly = {
+	.kind		= "sllin",
+	.maxtype	= IFLA_SLLIN_MAX,
+	.policy		= sllin_policy,
+	.priv_size	= sizeof(struct sllin),
+	.setup		= sll_setup,
+	.validate	= sllin_validate,
+	.newlink	= sllin_newlink,
+	.dellink	= sllin_dellink,
+	.changelink	= sllin_changelink,
+	.get_size	= sllin_get_size,
+	.fill_info	= sllin_fill_info,
+};
+
+/************************************
+ *  sllin_open helper routines.
+ ************************************/
+
+/*
+ * Allocate new SLLIN channel with the lowest free index. The netdevice
+ * is freed (and the index released) by sll_free_netdev() after the
+ * line discipline is closed.
+ */
+static struct sllin *sll_alloc(void)
+{
+	char name[IFNAMSIZ];
+	int i;
+	int j;
+	struct net_device *dev;
+	struct sllin       *sl;
+
+	/* Reserve the index, the netdevice is stored when allocated */
+	idr_preload(GFP_KERNEL);
+	spin_lock(&sllin_idr_lock);
+	i = idr_alloc(&sllin_idr, NULL, 0, 0, GFP_NOWAIT);
+	spin_unlock(&sllin_idr_lock);
+	idr_preload_end();
+	if (i < 0)
+		return NULL;
+
+	sprintf(name, "sllin%d", i);
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0))
-		dev = alloc_netdev(sizeof(*sl), name, sll_setup);
+	dev = alloc_netdev(sizeof(*sl), name, sll_setup);
 #else
-		dev = alloc_netdev(sizeof(*sl), name, NET_NAME_UNKNOWN, sll_setup);
+	dev = alloc_netdev(sizeof(*sl), name, NET_NAME_UNKNOWN, sll_setup);
 #endif
 
-		if (!dev)
-			return NULL;
-		dev->base_addr  = i;
+	if (!dev) {
+		spin_lock(&sllin_idr_lock);
+		idr_remove(&sllin_idr, i);
+		spin_unlock(&sllin_idr_lock);
+		return NULL;
 	}
+	dev->base_addr  = i;
+	dev->rtnl_link_ops = &sllin_link_ops;
 
 	sl = netdev_priv(dev);
 	/* Initialize channel control data */
@@ -1553,7 +3918,14 @@ static struct sllin *sll_alloc(dev_t line)
 	sl->dev	= dev;
 	spin_lock_init(&sl->lock);
 	spin_lock_init(&sl->linfr_lock);
-	sllin_devs[i] = dev;
+	for (j = 0; j <= LIN_ID_MAX; j++)
+		seqcount_init(&sl->linfr_cache[j].seq);
+	spin_lock_init(&sl->sched_lock);
+	spin_lock_init(&sl->sm_lock);
+
+	spin_lock(&sllin_idr_lock);
+	idr_replace(&sllin_idr, dev, i);
+	spin_unlock(&sllin_idr_lock);
 
 	return sl;
 }
@@ -1587,9 +3959,6 @@ static int sllin_open(struct tty_struct *tty)
 	 */
 	rtnl_lock();
 
-	/* Collect hanged up channels. */
-	sll_sync();
-
 	sl = tty->disc_data;
 
 	err = -EEXIST;
@@ -1597,9 +3966,9 @@ static int sllin_open(struct tty_struct *tty)
 	if (sl && sl->magic == SLLIN_MAGIC)
 		goto err_exit;
 
-	/* OK.  Find a free SLLIN channel to use. */
-	err = -ENFILE;
-	sl = sll_alloc(tty_devnum(tty));
+	/* OK.  Allocate a new SLLIN channel. */
+	err = -ENOMEM;
+	sl = sll_alloc();
 	if (sl == NULL)
 		goto err_exit;
 
@@ -1607,59 +3976,88 @@ static int sllin_open(struct tty_struct *tty)
 	tty->disc_data = sl;
 	sl->line = tty_devnum(tty);
 
-	if (!test_bit(SLF_INUSE, &sl->flags)) {
-		/* Perform the low-level SLLIN initialization. */
-		sl->lin_master = master;
-		if (master)
-			pr_debug("sllin: Configured as MASTER\n");
-		else
-			pr_debug("sllin: Configured as SLAVE\n");
+	/* Perform the low-level SLLIN initialization. */
+	sl->lin_master = master;
+	if (master)
+		pr_debug("sllin: Configured as MASTER\n");
+	else
+		pr_debug("sllin: Configured as SLAVE\n");
 
-		sllin_reset_buffs(sl);
+	sllin_reset_buffs(sl);
 
-		sl->lin_baud = (baudrate == 0) ? LIN_DEFAULT_BAUDRATE : baudrate;
-		pr_debug("sllin: Baudrate set to %u\n", sl->lin_baud);
+	sl->lin_baud = (baudrate == 0) ? LIN_DEFAULT_BAUDRATE : baudrate;
+	pr_debug("sllin: Baudrate set to %u\n", sl->lin_baud);
+	sl->hdr_timeout_us = 0;
+	sllin_timing_update(sl);
+	sl->autobaud = false;
+	sl->monitor = false;
 
-		sl->lin_state = SLSTATE_IDLE;
+	sllin_set_state(sl, SLSTATE_IDLE);
 
-		hrtimer_init(&sl->rx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-		sl->rx_timer.function = sllin_rx_timeout_handler;
-		/* timeval_to_ktime(msg_head->ival1); */
-		sl->rx_timer_timeout = ns_to_ktime(
-			(1000000000l / sl->lin_baud) *
-			SLLIN_SAMPLES_PER_CHAR * SLLIN_CHARS_TO_TIMEOUT);
+	hrtimer_init(&sl->rx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sl->rx_timer.function = sllin_rx_timeout_handler;
+
+	sl->break_phase = SLLIN_BREAK_NONE;
+#ifndef BREAK_BY_BAUD
+	hrtimer_init(&sl->break_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sl->break_timer.function = sllin_break_timer_handler;
+#endif
+
+	hrtimer_init(&sl->sched_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sl->sched_timer.function = sllin_sched_timer_handler;
+	sl->sched_active = LIN_SCHED_TABLE_NONE;
+	sl->sched_next = LIN_SCHED_TABLE_NONE;
+	memset(sl->sched_tables, 0, sizeof(sl->sched_tables));
+
+	hrtimer_init(&sl->diag_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sl->diag_timer.function = sllin_diag_timer_handler;
+	mutex_init(&sl->diag_mutex);
+	init_waitqueue_head(&sl->diag_wq);
+	memset(&sl->diag, 0, sizeof(sl->diag));
+
+	memset(sl->resp_timeout_us, 0, sizeof(sl->resp_timeout_us));
+	memset(sl->evt, 0, sizeof(sl->evt));
+	sl->evt_resolve_cnt = 0;
+	sl->evt_resolve_pos = 0;
+
+	set_bit(SLF_INUSE, &sl->flags);
+	clear_bit(SLF_STOPPING, &sl->flags);
+	clear_bit(SLF_ERROR, &sl->flags);
+
+	skb_queue_head_init(&sl->tx_queue);
+	skb_queue_head_init(&sl->rx_batch);
+	sl->worker = NULL;
+	sllin_worker_assign(sl, -1);
 
-		set_bit(SLF_INUSE, &sl->flags);
+	sltty_change_speed(tty, sl->lin_baud);
+
+	memset(sl->id_stats, 0, sizeof(sl->id_stats));
 
-		init_waitqueue_head(&sl->kwt_wq);
-		sl->kwthread = kthread_run(sllin_kwthread, sl, "sllin");
-		if (sl->kwthread == NULL)
-			goto err_free_chan;
+	err = register_netdevice(sl->dev);
+	if (err)
+		goto err_free_chan;
 
-		err = register_netdevice(sl->dev);
-		if (err)
-			goto err_free_chan_and_thread;
+	sl->debugfs = debugfs_create_file(sl->dev->name, S_IRUGO,
+		sllin_debugfs_dir, sl, &sllin_debugfs_fops);
 
 #ifdef SLLIN_LED_TRIGGER
-		devm_sllin_led_init(sl->dev);
+	devm_sllin_led_init(sl->dev);
 #endif
-	}
 
 	/* Done.  We have linked the TTY line to a channel. */
 	rtnl_unlock();
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 12, 0)
 	tty->receive_room = SLLIN_BUFF_LEN * 40; /* We don't flow control */
+#endif
 
 	/* TTY layer expects 0 on success */
 	return 0;
 
-err_free_chan_and_thread:
-	kthread_stop(sl->kwthread);
-	sl->kwthread = NULL;
-
 err_free_chan:
 	sl->tty = NULL;
 	tty->disc_data = NULL;
 	clear_bit(SLF_INUSE, &sl->flags);
+	sll_free_netdev(sl->dev);
 
 err_exit:
 	rtnl_unlock();
@@ -1684,11 +4082,32 @@ static void sllin_close(struct tty_struct *tty)
 	if (!sl || sl->magic != SLLIN_MAGIC || sl->tty != tty)
 		return;
 
-	kthread_stop(sl->kwthread);
-	sl->kwthread = NULL;
+	/* No more frames from the network stack and no more breaks */
+	spin_lock_bh(&sl->lock);
+	set_bit(SLF_STOPPING, &sl->flags);
+	spin_unlock_bh(&sl->lock);
+
+	sllin_sched_stop(sl);
+	sllin_diag_abort(sl, -ENODEV);
+	hrtimer_cancel(&sl->diag_timer);
+	sllin_tx_queue_purge(sl);
+	hrtimer_cancel(&sl->rx_timer);
+	kthread_flush_work(&sl->work);
+	sllin_break_abort(sl);
+	kthread_flush_work(&sl->work);
+	/* The work might have rearmed the timer */
+	hrtimer_cancel(&sl->rx_timer);
+	skb_queue_purge(&sl->rx_batch);
+	netdev_dbg(sl->dev, "%s: channel stopped\n", __func__);
 
+	/* Serialized with sllin_changelink() */
+	rtnl_lock();
 	tty->disc_data = NULL;
 	sl->tty = NULL;
+	rtnl_unlock();
+
+	debugfs_remove(sl->debugfs);
+	sl->debugfs = NULL;
 
 	/* Flush network side */
 	unregister_netdev(sl->dev);
@@ -1722,6 +4141,39 @@ static int sllin_ioctl(struct tty_struct *tty, struct file *file,
 	case SIOCSIFHWADDR:
 		return -EINVAL;
 
+	case SLLIN_IOC_SCHED_SET_TABLE:
+		return sllin_sched_set_table(sl,
+			(struct lin_sched_table __user *)arg);
+
+	case SLLIN_IOC_SCHED_SWITCH:
+		if (get_user(tmp, (int __user *)arg))
+			return -EFAULT;
+		return sllin_sched_switch(sl, (int)tmp);
+
+	case SLLIN_IOC_SET_CPU:
+		if (get_user(tmp, (int __user *)arg))
+			return -EFAULT;
+		if (netif_running(sl->dev))
+			return -EBUSY;
+		return sllin_worker_assign(sl, (int)tmp);
+
+	case SLLIN_IOC_CACHE_LOAD:
+		return sllin_cache_load(sl, (struct lin_cache __user *)arg);
+
+	case SLLIN_IOC_CACHE_DUMP:
+		return sllin_cache_dump(sl, (struct lin_cache __user *)arg);
+
+	case SLLIN_IOC_DIAG_TRANSFER:
+		return sllin_diag_transfer(sl,
+			(struct lin_diag_transfer __user *)arg);
+
+	case SLLIN_IOC_EVT_SET:
+		return sllin_evt_set(sl, (struct lin_evt_frame __user *)arg);
+
+	case SLLIN_IOC_SET_RESP_TIMEOUT:
+		return sllin_set_resp_timeout(sl,
+			(struct lin_resp_timeout __user *)arg);
+
 	default:
 		return tty_mode_ioctl(tty, file, cmd, arg);
 	}
@@ -1735,7 +4187,11 @@ static struct tty_ldisc_ops sll_ldisc = {
 	.close		= sllin_close,
 	.hangup		= sllin_hangup,
 	.ioctl		= sllin_ioctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 12, 0)
 	.receive_buf	= sllin_receive_buf,
+#else
+	.receive_buf2	= sllin_receive_buf2,
+#endif
 	.write_wakeup	= sllin_write_wakeup,
 };
 
@@ -1749,29 +4205,37 @@ static int __init sllin_init(void)
 		pr_err("sllin: can't register netdevice notifier\n");
 #endif
 
-	if (maxdev < 4)
-		maxdev = 4; /* Sanity */
-
 	printk(banner);
-	pr_debug("sllin: %d dynamic interface channels.\n", maxdev);
 
-	sllin_devs = kzalloc(sizeof(struct net_device *)*maxdev, GFP_KERNEL);
-	if (!sllin_devs) {
-		pr_err("sllin: can't allocate sllin device array!\n");
-		return -ENOMEM;
+	status = sllin_workers_create();
+	if (status) {
+		pr_err("sllin: can't create worker threads\n");
+		return status;
+	}
+	sllin_debugfs_dir = debugfs_create_dir("sllin", NULL);
+	pr_debug("sllin: %d worker threads.\n", sllin_workers_cnt);
+
+	status = rtnl_link_register(&sllin_link_ops);
+	if (status) {
+		pr_err("sllin: can't register rtnl link ops\n");
+		debugfs_remove_recursive(sllin_debugfs_dir);
+		sllin_workers_destroy();
+		return status;
 	}
 
 	/* Fill in our line protocol discipline, and register it */
 	status = tty_register_ldisc(N_SLLIN, &sll_ldisc);
 	if (status)  {
 		pr_err("sllin: can't register line discipline\n");
-		kfree(sllin_devs);
+		rtnl_link_unregister(&sllin_link_ops);
+		debugfs_remove_recursive(sllin_debugfs_dir);
+		sllin_workers_destroy();
 	}
 
 #ifdef BREAK_BY_BAUD
 	pr_debug("sllin: Break is generated by baud-rate change.");
 #else
-	pr_debug("sllin: Break is generated manually with tiny sleep.");
+	pr_debug("sllin: Break is generated manually with hrtimer.");
 #endif
 
 	return status;
@@ -1785,9 +4249,6 @@ static void __exit sllin_exit(void)
 	unsigned long timeout = jiffies + HZ;
 	int busy = 0;
 
-	if (sllin_devs == NULL)
-		return;
-
 	/* First of all: check for active disciplines and hangup them.
 	 */
 	do {
@@ -1795,10 +4256,8 @@ static void __exit sllin_exit(void)
 			msleep_interruptible(100);
 
 		busy = 0;
-		for (i = 0; i < maxdev; i++) {
-			dev = sllin_devs[i];
-			if (!dev)
-				continue;
+		spin_lock(&sllin_idr_lock);
+		idr_for_each_entry(&sllin_idr, dev, i) {
 			sl = netdev_priv(dev);
 			spin_lock_bh(&sl->lock);
 			if (sl->tty) {
@@ -1807,29 +4266,38 @@ static void __exit sllin_exit(void)
 			}
 			spin_unlock_bh(&sl->lock);
 		}
+		spin_unlock(&sllin_idr_lock);
 	} while (busy && time_before(jiffies, timeout));
 
 	/* FIXME: hangup is async so we should wait when doing this second
 	   phase */
 
-	for (i = 0; i < maxdev; i++) {
-		dev = sllin_devs[i];
+	for (;;) {
+		i = 0;
+		spin_lock(&sllin_idr_lock);
+		dev = idr_get_next(&sllin_idr, &i);
+		spin_unlock(&sllin_idr_lock);
 		if (!dev)
-			continue;
-		sllin_devs[i] = NULL;
+			break;
 
 		sl = netdev_priv(dev);
 		if (sl->tty) {
 			netdev_dbg(sl->dev, "tty discipline still running\n");
 			/* Intentionally leak the control block. */
 			dev->destructor = NULL;
+			spin_lock(&sllin_idr_lock);
+			idr_remove(&sllin_idr, i);
+			spin_unlock(&sllin_idr_lock);
 		}
 
 		unregister_netdev(dev);
 	}
 
-	kfree(sllin_devs);
-	sllin_devs = NULL;
+	idr_destroy(&sllin_idr);
+
+	rtnl_link_unregister(&sllin_link_ops);
+	sllin_workers_destroy();
+	debugfs_remove_recursive(sllin_debugfs_dir);
 
 	i = tty_unregister_ldisc(N_SLLIN);
 	if (i)
@@ -0,0 +1,180 @@
+/*
+ * sllin_trace.h - Tracepoints of sllin state machine
+ *
+ * Enable by e.g.
+ *   echo 1 > /sys/kernel/debug/tracing/events/sllin/enable
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sllin
+
+#if !defined(_SLLIN_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SLLIN_TRACE_H
+
+#ifndef SLLIN_USERSPACE
+#include <linux/netdevice.h>
+#include <linux/tracepoint.h>
+#endif
+
+/* Values of enum slstate in sllin.c */
+#define sllin_show_state(state)						\
+	__print_symbolic(state,						\
+		{ 0, "IDLE" },						\
+		{ 1, "BREAK_SENT" },					\
+		{ 2, "ID_SENT" },					\
+		{ 3, "RESPONSE_WAIT" },					\
+		{ 4, "RESPONSE_WAIT_BUS" },				\
+		{ 5, "ID_RECEIVED" },					\
+		{ 6, "RESPONSE_SENT" })
+
+#define SLLIN_TRACE_TIMER_RX		0
+#define SLLIN_TRACE_TIMER_BREAK		1
+#define SLLIN_TRACE_TIMER_SCHED		2
+
+#define SLLIN_TRACE_TIMER_START		0
+#define SLLIN_TRACE_TIMER_CANCEL	1
+#define SLLIN_TRACE_TIMER_EXPIRE	2
+
+TRACE_EVENT(sllin_state,
+	TP_PROTO(struct net_device *dev, int lin_id, int old_state,
+		int new_state),
+
+	TP_ARGS(dev, lin_id, old_state, new_state),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev->name	)
+		__field(	int,		lin_id		)
+		__field(	int,		old_state	)
+		__field(	int,		new_state	)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->lin_id		= lin_id;
+		__entry->old_state	= old_state;
+		__entry->new_state	= new_state;
+	),
+
+	TP_printk("%s: id=%d %s -> %s", __get_str(name), __entry->lin_id,
+		sllin_show_state(__entry->old_state),
+		sllin_show_state(__entry->new_state))
+);
+
+TRACE_EVENT(sllin_rx,
+	TP_PROTO(struct net_device *dev, int lin_id, int idx,
+		unsigned char c, char flag),
+
+	TP_ARGS(dev, lin_id, idx, c, flag),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev->name	)
+		__field(	int,		lin_id		)
+		__field(	int,		idx		)
+		__field(	unsigned char,	c		)
+		__field(	char,		flag		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->lin_id		= lin_id;
+		__entry->idx		= idx;
+		__entry->c		= c;
+		__entry->flag		= flag;
+	),
+
+	TP_printk("%s: id=%d rx[%d]=0x%02x flag=%d", __get_str(name),
+		__entry->lin_id, __entry->idx, __entry->c, __entry->flag)
+);
+
+TRACE_EVENT(sllin_tx,
+	TP_PROTO(struct net_device *dev, int lin_id, int offset, int written,
+		int remains),
+
+	TP_ARGS(dev, lin_id, offset, written, remains),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev->name	)
+		__field(	int,		lin_id		)
+		__field(	int,		offset		)
+		__field(	int,		written		)
+		__field(	int,		remains		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->lin_id		= lin_id;
+		__entry->offset		= offset;
+		__entry->written	= written;
+		__entry->remains	= remains;
+	),
+
+	TP_printk("%s: id=%d tx[%d] written=%d remains=%d", __get_str(name),
+		__entry->lin_id, __entry->offset, __entry->written,
+		__entry->remains)
+);
+
+TRACE_EVENT(sllin_timer,
+	TP_PROTO(struct net_device *dev, int lin_id, int timer, int action,
+		s64 expires_ns),
+
+	TP_ARGS(dev, lin_id, timer, action, expires_ns),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev->name	)
+		__field(	int,		lin_id		)
+		__field(	int,		timer		)
+		__field(	int,		action		)
+		__field(	s64,		expires_ns	)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->lin_id		= lin_id;
+		__entry->timer		= timer;
+		__entry->action		= action;
+		__entry->expires_ns	= expires_ns;
+	),
+
+	TP_printk("%s: id=%d %s timer %s expires=%lld", __get_str(name),
+		__entry->lin_id,
+		__print_symbolic(__entry->timer,
+			{ SLLIN_TRACE_TIMER_RX, "rx" },
+			{ SLLIN_TRACE_TIMER_BREAK, "break" },
+			{ SLLIN_TRACE_TIMER_SCHED, "sched" }),
+		__print_symbolic(__entry->action,
+			{ SLLIN_TRACE_TIMER_START, "start" },
+			{ SLLIN_TRACE_TIMER_CANCEL, "cancel" },
+			{ SLLIN_TRACE_TIMER_EXPIRE, "expire" }),
+		(long long)__entry->expires_ns)
+);
+
+TRACE_EVENT(sllin_error,
+	TP_PROTO(struct net_device *dev, int lin_id, int err),
+
+	TP_ARGS(dev, lin_id, err),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev->name	)
+		__field(	int,		lin_id		)
+		__field(	int,		err		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->lin_id		= lin_id;
+		__entry->err		= err;
+	),
+
+	TP_printk("%s: id=%d err=0x%x", __get_str(name), __entry->lin_id,
+		__entry->err)
+);
+
+#endif /* _SLLIN_TRACE_H */
+
+#ifndef SLLIN_USERSPACE
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sllin_trace
+#include <trace/define_trace.h>
+#endif